@@ -0,0 +1,228 @@
+#include "activationclaim.h"
+
+#include <QDBusPendingCallWatcher>
+#include <QDBusConnectionInterface>
+#include <QDBusServiceWatcher>
+#include <QDBusVirtualObject>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QTimer>
+#include <QDebug>
+#include <QFile>
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Calls queued for a component that never takes its name over are failed after this.
+static const int handOverTimeout = 25 * 1000;
+
+namespace {
+
+/*! Answers every path on the private connection by queueing the call in its claim. */
+class PlaceholderObject : public QDBusVirtualObject
+{
+public:
+    explicit PlaceholderObject(ActivationClaim *claim)
+        : QDBusVirtualObject(claim)
+        , m_claim(claim)
+    {
+    }
+
+    QString introspect(const QString &path) const override
+    {
+        Q_UNUSED(path)
+        return QString();
+    }
+
+    bool handleMessage(const QDBusMessage &message, const QDBusConnection &connection) override
+    {
+        Q_UNUSED(connection)
+        // May run on the D-Bus thread, the claim lives on the main thread.
+        ActivationClaim *claim = m_claim;
+        QMetaObject::invokeMethod(claim, [claim, message] { claim->queue(message); });
+        return true;
+    }
+
+private:
+    ActivationClaim *m_claim;
+};
+
+}
+
+ActivationClaim::ActivationClaim(const SessionComponent &component, QObject *parent)
+    : QObject(parent)
+    , m_component(component)
+    , m_target(component.activation.section(QLatin1Char(':'), 1))
+    , m_connection(QString())
+    , m_placeholder(nullptr)
+    , m_ownerWatcher(nullptr)
+    , m_forwardTimeout(new QTimer(this))
+    , m_socket(-1)
+    , m_notifier(nullptr)
+    , m_armed(false)
+    , m_handedOver(false)
+    , m_ownerPresent(false)
+{
+    m_forwardTimeout->setSingleShot(true);
+    m_forwardTimeout->setInterval(handOverTimeout);
+    connect(m_forwardTimeout, &QTimer::timeout, this, [this] {
+        failQueued(QStringLiteral("%1 did not take over %2").arg(m_component.name, m_target));
+    });
+
+    if (!isDBus() && !m_target.startsWith(QLatin1Char('/')))
+        m_target = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + QLatin1Char('/') + m_target;
+}
+
+ActivationClaim::~ActivationClaim()
+{
+    failQueued(QStringLiteral("Session is shutting down"));
+
+    if (!m_connectionName.isEmpty()) {
+        m_connection.unregisterVirtualObject(QStringLiteral("/"));
+        QDBusConnection::disconnectFromBus(m_connectionName);
+    }
+
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        QFile::remove(m_target);
+    }
+}
+
+bool ActivationClaim::claim()
+{
+    m_handedOver = false;
+    m_ownerPresent = false;
+
+    if (isDBus()) {
+        if (m_connectionName.isEmpty()) {
+            m_connectionName = QStringLiteral("prts-activation-") + m_component.name;
+            m_connection = QDBusConnection::connectToBus(QDBusConnection::SessionBus, m_connectionName);
+            m_placeholder = new PlaceholderObject(this);
+            m_connection.registerVirtualObject(QStringLiteral("/"), m_placeholder, QDBusConnection::SubPath);
+        }
+
+        const QDBusReply<QDBusConnectionInterface::RegisterServiceReply> reply =
+                m_connection.interface()->registerService(m_target, QDBusConnectionInterface::DontQueueService,
+                                                          QDBusConnectionInterface::DontAllowReplacement);
+        if (!reply.isValid() || reply.value() != QDBusConnectionInterface::ServiceRegistered) {
+            qWarning() << "Could not claim bus name" << m_target << "for" << m_component.name;
+            return false;
+        }
+    } else if (m_socket < 0) {
+        const QByteArray path = QFile::encodeName(m_target);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (size_t(path.size()) >= sizeof(addr.sun_path))
+            return false;
+        memcpy(addr.sun_path, path.constData(), size_t(path.size()));
+
+        ::unlink(path.constData());
+        m_socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_socket < 0 || ::bind(m_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+                || ::listen(m_socket, SOMAXCONN) != 0) {
+            qWarning() << "Could not claim socket" << m_target << "for" << m_component.name << strerror(errno);
+            if (m_socket >= 0)
+                ::close(m_socket);
+            m_socket = -1;
+            return false;
+        }
+
+        // Only the first connection matters, the component accepts it and all later ones.
+        m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, [this] {
+            m_notifier->setEnabled(false);
+            if (m_armed) {
+                m_armed = false;
+                emit activated();
+            }
+        });
+    } else {
+        m_notifier->setEnabled(true);
+    }
+
+    m_armed = true;
+    qDebug() << "Waiting for first use of" << m_component.name << "on" << m_target;
+    return true;
+}
+
+void ActivationClaim::handOver()
+{
+    m_armed = false;
+    // A component started without a client, e.g. by restore, leaves the notifier enabled:
+    // the listening socket stays readable once clients queue up, and would busy-wake the loop.
+    if (m_notifier)
+        m_notifier->setEnabled(false);
+    if (!isDBus() || m_handedOver)
+        return;
+
+    m_handedOver = true;
+
+    if (!m_ownerWatcher) {
+        m_ownerWatcher = new QDBusServiceWatcher(m_target, QDBusConnection::sessionBus(),
+                                                 QDBusServiceWatcher::WatchForRegistration, this);
+        connect(m_ownerWatcher, &QDBusServiceWatcher::serviceRegistered, this, [this] {
+            if (!m_handedOver)
+                return;
+            m_ownerPresent = true;
+            m_forwardTimeout->stop();
+            forwardQueued();
+        });
+    }
+
+    m_connection.interface()->unregisterService(m_target);
+    if (!m_queue.isEmpty())
+        m_forwardTimeout->start();
+}
+
+void ActivationClaim::queue(const QDBusMessage &message)
+{
+    m_queue.append(message);
+
+    if (m_ownerPresent) {
+        // Sent before we released the name, the component already has it.
+        forwardQueued();
+    } else if (m_armed) {
+        m_armed = false;
+        emit activated();
+    }
+}
+
+void ActivationClaim::forwardQueued()
+{
+    const QList<QDBusMessage> queued = m_queue;
+    m_queue.clear();
+
+    for (const QDBusMessage &message : queued) {
+        QDBusMessage call = QDBusMessage::createMethodCall(m_target, message.path(), message.interface(), message.member());
+        call.setArguments(message.arguments());
+
+        if (!message.isReplyRequired()) {
+            QDBusConnection::sessionBus().send(call);
+            continue;
+        }
+
+        // Replies have to come from the connection that received the call.
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(call), this);
+        connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, watcher, message] {
+            const QDBusMessage reply = watcher->reply();
+            if (reply.type() == QDBusMessage::ErrorMessage)
+                m_connection.send(message.createErrorReply(reply.errorName(), reply.errorMessage()));
+            else
+                m_connection.send(message.createReply(reply.arguments()));
+            watcher->deleteLater();
+        });
+    }
+}
+
+void ActivationClaim::failQueued(const QString &error)
+{
+    for (const QDBusMessage &message : qAsConst(m_queue)) {
+        if (message.isReplyRequired())
+            m_connection.send(message.createErrorReply(QDBusError::ServiceUnknown, error));
+    }
+    m_queue.clear();
+}
@@ -0,0 +1,67 @@
+#ifndef ACTIVATIONCLAIM_H
+#define ACTIVATIONCLAIM_H
+
+#include <QObject>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QList>
+
+#include "sessionmanifest.h"
+
+class QDBusServiceWatcher;
+class QDBusVirtualObject;
+class QSocketNotifier;
+class QTimer;
+
+/*! Placeholder for a component declared with Activation= in the session manifest.
+    For "dbus:" the session owns the bus name on a private connection and queues incoming
+    calls, for "socket:" it listens on the socket. activated() tells the session to start the
+    component, queued calls are forwarded once the component owns the name, and the socket
+    is inherited as LISTEN_FDS. Forwarded calls reach the component from the session's connection.
+*/
+class ActivationClaim : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ActivationClaim(const SessionComponent &component, QObject *parent = nullptr);
+    ~ActivationClaim() override;
+
+    bool isDBus() const { return m_component.activation.startsWith(QLatin1String("dbus:")); }
+    /// The listening socket for "socket:" claims, -1 otherwise.
+    int socket() const { return m_socket; }
+
+    /// Takes the name or binds the socket and waits for the first client.
+    /// Called again after the component exited, so the next client starts it again.
+    bool claim();
+    /// Stops waiting for clients right before the component is started, and releases the bus name.
+    void handOver();
+
+    /// Queues a call received by the placeholder object.
+    void queue(const QDBusMessage &message);
+
+signals:
+    void activated();
+
+private:
+    void forwardQueued();
+    void failQueued(const QString &error);
+
+    SessionComponent m_component;
+    QString m_target;
+
+    QDBusConnection m_connection;
+    QString m_connectionName;
+    QDBusVirtualObject *m_placeholder;
+    QList<QDBusMessage> m_queue;
+    QDBusServiceWatcher *m_ownerWatcher;
+    QTimer *m_forwardTimeout;
+
+    int m_socket;
+    QSocketNotifier *m_notifier;
+    bool m_armed;
+    bool m_handedOver;
+    bool m_ownerPresent;
+};
+
+#endif // ACTIVATIONCLAIM_H
@@ -0,0 +1,190 @@
+#include "admissioncontroller.h"
+#include "sessionmetrics.h"
+
+#include <QSettings>
+#include <QTimer>
+#include <QDebug>
+#include <QFile>
+
+#include <unistd.h>
+
+// Pressure is checked this often while launches are waiting.
+static const int pollInterval = 250;
+// Below this pressure the system counts as idle for deferrable launches.
+static const double idlePressure = 5.0;
+// Launches held back by pressure this long are started anyway, so the login always completes.
+static const int maxPressureHold = 15 * 1000;
+// Deferrable launches start after this long even if the system never goes idle.
+static const int maxDeferHold = 60 * 1000;
+
+AdmissionController::AdmissionController(QObject *parent)
+    : QObject(parent)
+    , m_exclusiveRunning(false)
+    , m_drained(false)
+    , m_maxInFlight(qMax(1, int(sysconf(_SC_NPROCESSORS_ONLN))))
+    , m_timer(new QTimer(this))
+    , m_wait(SessionMetrics::self()->histogram("prts_session_admission_wait_seconds",
+                                               "Time launches waited for admission."))
+{
+    QSettings settings(QSettings::UserScope, "PRTS", "session");
+    settings.beginGroup("Admission");
+    m_maxInFlight = qMax(1, settings.value("MaxInFlight", m_maxInFlight).toInt());
+    m_cpuThreshold = settings.value("CpuPressure", 40.0).toDouble();
+    m_ioThreshold = settings.value("IoPressure", 30.0).toDouble();
+    m_idlePeriod = settings.value("IdlePeriod", 10 * 1000).toInt();
+
+    m_timer->setInterval(pollInterval);
+    connect(m_timer, &QTimer::timeout, this, &AdmissionController::admit);
+}
+
+double AdmissionController::pressure(const char *resource)
+{
+    QFile file(QStringLiteral("/proc/pressure/") + QLatin1String(resource));
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    // some avg10=1.23 avg60=0.50 avg300=0.10 total=12345
+    const QByteArray line = file.readLine();
+    const int start = line.indexOf("avg10=");
+    if (!line.startsWith("some") || start < 0)
+        return -1;
+
+    const int end = line.indexOf(' ', start);
+    return line.mid(start + 6, end - start - 6).toDouble();
+}
+
+void AdmissionController::enqueue(const QString &name, const std::function<void()> &start, Flags flags)
+{
+    enqueueBatch({ Request { name, start, flags } });
+}
+
+void AdmissionController::enqueueBatch(const QList<Request> &requests)
+{
+    for (const Request &request : requests) {
+        Pending pending;
+        pending.request = request;
+        pending.queued.start();
+        m_queue.append(pending);
+    }
+
+    // Every batch ends with drained(), even one that only holds deferrable launches.
+    m_drained = false;
+    schedule();
+}
+
+void AdmissionController::release(const QString &name)
+{
+    if (!m_inFlight.remove(name))
+        return;
+    m_backgroundInFlight.remove(name);
+    m_deferredInFlight.remove(name);
+
+    if (m_inFlight.isEmpty())
+        m_exclusiveRunning = false;
+
+    schedule();
+}
+
+void AdmissionController::setFlag(const QString &name, Flag flag, bool on)
+{
+    for (Pending &pending : m_queue) {
+        if (pending.request.name == name)
+            pending.request.flags.setFlag(flag, on);
+    }
+
+    schedule();
+}
+
+void AdmissionController::schedule()
+{
+    // Admit from the event loop, callers may still be setting up.
+    QMetaObject::invokeMethod(this, &AdmissionController::admit, Qt::QueuedConnection);
+}
+
+bool AdmissionController::isUnderPressure(double cpu, double io) const
+{
+    return cpu > m_cpuThreshold || io > m_ioThreshold;
+}
+
+void AdmissionController::updateIdle(double cpu, double io)
+{
+    const bool idle = m_inFlight.isEmpty() && cpu < idlePressure && io < idlePressure;
+
+    if (!idle)
+        m_idleSince.invalidate();
+    else if (!m_idleSince.isValid())
+        m_idleSince.start();
+}
+
+void AdmissionController::admit()
+{
+    // Each pressure file is read once per tick.
+    const double cpu = pressure("cpu");
+    const double io = pressure("io");
+    updateIdle(cpu, io);
+    const bool underPressure = isUnderPressure(cpu, io);
+
+    // Starting a launch may queue further ones, index instead of iterating.
+    for (int i = 0; i < m_queue.size();) {
+        if (m_exclusiveRunning || m_inFlight.size() >= m_maxInFlight)
+            break;
+
+        const Pending &candidate = m_queue.at(i);
+
+        if (candidate.request.flags & Deferrable) {
+            const bool idle = m_idleSince.isValid() && m_idleSince.elapsed() >= m_idlePeriod;
+            if (!idle && candidate.queued.elapsed() < maxDeferHold) {
+                ++i;
+                continue;
+            }
+        } else if (underPressure && candidate.queued.elapsed() < maxPressureHold) {
+            break;
+        }
+
+        if ((candidate.request.flags & Exclusive) && !m_inFlight.isEmpty())
+            break;
+
+        // Background launches leave slots for the others, which may overtake them.
+        if ((candidate.request.flags & Background) && m_backgroundInFlight.size() >= qMax(1, m_maxInFlight / 2)) {
+            ++i;
+            continue;
+        }
+
+        const Pending pending = m_queue.takeAt(i);
+
+        m_wait->observe(pending.queued);
+        m_inFlight.insert(pending.request.name);
+        if (pending.request.flags & Background)
+            m_backgroundInFlight.insert(pending.request.name);
+        if (pending.request.flags & Deferrable)
+            m_deferredInFlight.insert(pending.request.name);
+        m_exclusiveRunning = pending.request.flags & Exclusive;
+        // A deferrable launch ends the idle period for the next one.
+        m_idleSince.invalidate();
+
+        pending.request.start();
+    }
+
+    if (m_queue.isEmpty())
+        m_timer->stop();
+    else if (!m_timer->isActive())
+        m_timer->start();
+
+    // Deferrable launches were explicitly not needed at login, they finish on their own.
+    const bool done = isDrained();
+    if (done && !m_drained)
+        emit drained();
+    m_drained = done;
+}
+
+bool AdmissionController::isDrained() const
+{
+    if (m_inFlight.size() > m_deferredInFlight.size())
+        return false;
+
+    for (const Pending &pending : m_queue) {
+        if (!(pending.request.flags & Deferrable))
+            return false;
+    }
+    return true;
+}
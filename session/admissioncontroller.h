@@ -0,0 +1,95 @@
+#ifndef ADMISSIONCONTROLLER_H
+#define ADMISSIONCONTROLLER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSet>
+
+#include <functional>
+
+class QTimer;
+class MetricHistogram;
+
+/*! Paces launches so a login does not saturate the machine while the compositor draws its first frames.
+    At most one launch per online CPU is in flight, from start until the caller calls release().
+    New launches wait while CPU or IO pressure (PSI) is high, deferrable ones until the system is idle.
+*/
+class AdmissionController : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Flag {
+        NoFlags = 0,
+        /// Waits until the system has been idle for the configured period, at most a minute.
+        Deferrable = 1,
+        /// Runs alone: waits for all other launches and holds back the following ones.
+        Exclusive = 2,
+        /// Runs alongside other launches, but on at most half of the in-flight slots.
+        Background = 4
+    };
+    Q_DECLARE_FLAGS(Flags, Flag)
+
+    struct Request {
+        QString name;
+        std::function<void()> start;
+        Flags flags = NoFlags;
+    };
+
+    explicit AdmissionController(QObject *parent = nullptr);
+
+    void enqueue(const QString &name, const std::function<void()> &start, Flags flags = NoFlags);
+    /// Queues several launches at once, they are admitted in list order.
+    void enqueueBatch(const QList<Request> &requests);
+    /// Marks a launch as done, ready or failed, freeing its slot.
+    void release(const QString &name);
+    /// Changes a flag of a launch that is still queued, e.g. when the power source changed.
+    void setFlag(const QString &name, Flag flag, bool on);
+
+    int maxInFlight() const { return m_maxInFlight; }
+    int inFlight() const { return m_inFlight.size(); }
+    int pending() const { return m_queue.size(); }
+
+    /// Reads the "some avg10" value of /proc/pressure/<resource>, -1 without PSI support.
+    static double pressure(const char *resource);
+
+signals:
+    /// Emitted once every launch that is not Deferrable was admitted and released,
+    /// deferrable ones may still be waiting or in flight.
+    void drained();
+
+private slots:
+    void admit();
+
+private:
+    struct Pending {
+        Request request;
+        QElapsedTimer queued;
+    };
+
+    bool isUnderPressure(double cpu, double io) const;
+    void updateIdle(double cpu, double io);
+    void schedule();
+    bool isDrained() const;
+
+    QList<Pending> m_queue;
+    QSet<QString> m_inFlight;
+    QSet<QString> m_backgroundInFlight;
+    QSet<QString> m_deferredInFlight;
+    bool m_exclusiveRunning;
+    bool m_drained;
+
+    int m_maxInFlight;
+    double m_cpuThreshold;
+    double m_ioThreshold;
+    int m_idlePeriod;
+
+    QElapsedTimer m_idleSince;
+    QTimer *m_timer;
+    MetricHistogram *m_wait;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(AdmissionController::Flags)
+
+#endif // ADMISSIONCONTROLLER_H
@@ -1,103 +1,322 @@
 #include "application.h"
 #include "sessionadaptor.h"
+#include "sessionenvironment.h"
 
 #include <QDBusConnection>
+#include <QDBusMessage>
+#include <QSocketNotifier>
 #include <QStandardPaths>
+#include <QFileInfo>
+#include <QFile>
 #include <QSettings>
 #include <QProcess>
+#include <QTimer>
 #include <QDebug>
 #include <QDir>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const QByteArray stateMagic("PRTS-REEXEC");
+static const quint32 stateVersion = 3;
+static int s_signalFd[2] = { -1, -1 };
+
+static void signalHandler(int signal)
+{
+    const char c = char(signal);
+    ssize_t ret = ::write(s_signalFd[0], &c, sizeof(c));
+    Q_UNUSED(ret)
+}
+
 Application::Application(int &argc, char **argv)
-    : QApplication(argc, argv)
+    : QCoreApplication(argc, argv)
     , m_processManager(new ProcessManager)
+    , m_reexecPending(false)
 {
     qDebug() << "Initializing application";
     new SessionAdaptor(this);
+    new EventLoopMonitor(this);
+
+    connect(m_processManager, &ProcessManager::phaseChanged, this, &Application::onPhaseChanged);
+    connect(m_processManager, &ProcessManager::componentStateChanged, this, &Application::ComponentStateChanged);
+    connect(m_processManager, &ProcessManager::x11ActiveChanged, this, &Application::onX11ActiveChanged);
+
+    // Scheduling follows the power source for the whole session.
+    m_processManager->setOnBattery(m_power.onBattery());
+    connect(&m_power, &Power::onBatteryChanged, m_processManager, &ProcessManager::setOnBattery);
 
     // connect to D-Bus and register as an object:
     QDBusConnection::sessionBus().registerService(QStringLiteral("org.cutefish.Session"));
     QDBusConnection::sessionBus().registerObject(QStringLiteral("/Session"), this);
 
+    initSignals();
+
+    // A re-executed session inherits the environment and its children, skip the startup.
+    const int stateIndex = arguments().indexOf(QStringLiteral("--restore-state"));
+    if (stateIndex > 0 && stateIndex + 1 < arguments().size()
+            && restoreState(arguments().at(stateIndex + 1).toInt())) {
+        qDebug() << "Session restored after re-exec";
+        return;
+    }
+
     createConfigDirectory();
     initEnvironments();
     initLanguage();
     initScreenScaleFactors();
+    initDisplaySockets();
 
     if (!syncDBusEnvironment()) {
         // Startup error
         qDebug() << "Could not sync environment to dbus.";
     }
 
+    m_processManager->setEnvironment(QProcessEnvironment::systemEnvironment());
+
     QTimer::singleShot(100, m_processManager, &ProcessManager::start);
 }
 
-void Application::initEnvironments()
+void Application::Reexec()
 {
-    // Set defaults
-    if (qEnvironmentVariableIsEmpty("XDG_DATA_HOME"))
-        qputenv("XDG_DATA_HOME", QDir::home().absoluteFilePath(QStringLiteral(".local/share")).toLocal8Bit());
-    if (qEnvironmentVariableIsEmpty("XDG_DESKTOP_DIR"))
-        qputenv("XDG_DESKTOP_DIR", QDir::home().absoluteFilePath(QStringLiteral("/Desktop")).toLocal8Bit());
-    if (qEnvironmentVariableIsEmpty("XDG_CONFIG_HOME"))
-        qputenv("XDG_CONFIG_HOME", QDir::home().absoluteFilePath(QStringLiteral(".config")).toLocal8Bit());
-    if (qEnvironmentVariableIsEmpty("XDG_CACHE_HOME"))
-        qputenv("XDG_CACHE_HOME", QDir::home().absoluteFilePath(QStringLiteral(".cache")).toLocal8Bit());
-    if (qEnvironmentVariableIsEmpty("XDG_DATA_DIRS"))
-        qputenv("XDG_DATA_DIRS", "/usr/local/share/:/usr/share/");
-    if (qEnvironmentVariableIsEmpty("XDG_CONFIG_DIRS"))
-        qputenv("XDG_CONFIG_DIRS", "/etc/xdg");
-
-    // Environment
-    qputenv("DISPLAY", ":1");
-    qputenv("DESKTOP_SESSION", "PRTS");
-    qputenv("XDG_CURRENT_DESKTOP", "PRTS");
-    qputenv("XDG_SESSION_DESKTOP", "PRTS");
-    qputenv("XDG_SESSION_TYPE", "wayland");
-
-    // Qt
-    qputenv("QT_QPA_PLATFORM", "wayland");
-    qputenv("QT_QPA_PLATFORMTHEME", "prts");
-    qputenv("QT_PLATFORM_PLUGIN", "wayland");
-
-    qunsetenv("QT_AUTO_SCREEN_SCALE_FACTOR");
-    qunsetenv("QT_SCALE_FACTOR");
-    qunsetenv("QT_SCREEN_SCALE_FACTORS");
-    qunsetenv("QT_ENABLE_HIGHDPI_SCALING");
-    qunsetenv("QT_USE_PHYSICAL_DPI");
-    qunsetenv("QT_FONT_DPI");
-    qputenv("QT_SCALE_FACTOR_ROUNDING_POLICY", "PassThrough");
-
-    // IM Config
-    qputenv("GTK_IM_MODULE", "fcitx5");
-    qputenv("QT4_IM_MODULE", "fcitx5");
-    qputenv("QT_IM_MODULE", "fcitx5");
-    qputenv("CLUTTER_IM_MODULE", "fcitx5");
-    qputenv("XMODIFIERS", "@im=fcitx");
+    // Let the event loop finish the current D-Bus dispatch first.
+    QTimer::singleShot(0, this, &Application::reexec);
 }
 
-void Application::initLanguage()
+void Application::initSignals()
 {
-    QSettings settings(QSettings::UserScope, "PRTS", "language");
-    QString value = settings.value("language", "en_US").toString();
-    QString str = QString("%1.UTF-8").arg(value);
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s_signalFd) != 0) {
+        qWarning() << "Could not create signal socket pair";
+        return;
+    }
+
+    // SIGHUP re-executes the session, SIGTERM ends it like a logout.
+    QSocketNotifier *notifier = new QSocketNotifier(s_signalFd[1], QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, [this] {
+        char c;
+        if (::read(s_signalFd[1], &c, sizeof(c)) != sizeof(c))
+            return;
+        if (c == SIGTERM)
+            m_processManager->logout();
+        else
+            reexec();
+    });
 
-    const auto lcValues = {
-        "LANG", "LC_NUMERIC", "LC_TIME", "LC_MONETARY", "LC_MEASUREMENT", "LC_COLLATE", "LC_CTYPE"
+    struct sigaction action = {};
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+void Application::reexec()
+{
+    // A half-started session would lose its pending startup steps, wait until it is running.
+    if (m_processManager->phase() >= ProcessManager::ShuttingDown) {
+        qWarning() << "Not re-executing, the session is shutting down";
+        return;
+    }
+    if (m_processManager->phase() < ProcessManager::Running) {
+        qDebug() << "Re-exec deferred until the session is running";
+        m_reexecPending = true;
+        return;
+    }
+    m_reexecPending = false;
+
+    // Prefer the binary on disk, after an upgrade /proc/self/exe still points at the old one.
+    QString program = arguments().constFirst();
+    if (!QFileInfo(program).isAbsolute() || !QFileInfo::exists(program))
+        program = QStandardPaths::findExecutable(QFileInfo(program).fileName());
+    if (program.isEmpty()) {
+        qWarning() << "Cannot re-exec: session binary not found";
+        return;
+    }
+
+    QByteArray state;
+    QDataStream out(&state, QIODevice::WriteOnly);
+    out << stateMagic << stateVersion;
+    m_processManager->saveState(out);
+
+    // Not close-on-exec, the new instance reads it back from --restore-state.
+    const int fd = ::memfd_create("prts-session-state", 0);
+    if (fd < 0 || ::write(fd, state.constData(), size_t(state.size())) != state.size()) {
+        qWarning() << "Cannot re-exec: could not write session state";
+        if (fd >= 0)
+            ::close(fd);
+        return;
+    }
+    ::lseek(fd, 0, SEEK_SET);
+
+    const QByteArray path = QFile::encodeName(program);
+    const QByteArray fdArg = QByteArray::number(fd);
+    char *argv[] = {
+        const_cast<char *>(path.constData()),
+        const_cast<char *>("--restore-state"),
+        const_cast<char *>(fdArg.constData()),
+        nullptr
     };
 
-    for (auto lc : lcValues) {
-        const QString value = str;
-        if (!value.isEmpty()) {
-            qputenv(lc, value.toUtf8());
+    qDebug() << "Re-executing" << program;
+    SessionMetrics::self()->writeExposition();
+    ::execv(path.constData(), argv);
+
+    qWarning() << "Re-exec failed:" << strerror(errno);
+    ::close(fd);
+}
+
+bool Application::restoreState(int fd)
+{
+    QFile file;
+    if (fd < 0 || !file.open(fd, QIODevice::ReadOnly, QFileDevice::AutoCloseHandle)) {
+        qWarning() << "Cannot read session state from fd" << fd;
+        return false;
+    }
+
+    const QByteArray state = file.readAll();
+    file.close();
+
+    QDataStream in(state);
+    QByteArray magic;
+    quint32 version;
+    in >> magic >> version;
+
+    if (magic != stateMagic || version != stateVersion) {
+        qWarning() << "Incompatible session state, starting a new session";
+        return false;
+    }
+
+    return m_processManager->restoreState(in);
+}
+
+uint Application::LaunchWithUrls(const QString &desktopId, const QStringList &urls)
+{
+    QProcess *process = m_processManager->launch(desktopId, urls);
+
+    if (!calledFromDBus())
+        return 0;
+
+    if (!process) {
+        sendErrorReply(QDBusError::InvalidArgs, QStringLiteral("Unknown or hidden desktop entry: %1").arg(desktopId));
+        return 0;
+    }
+
+    // Reply once the process has actually been spawned.
+    setDelayedReply(true);
+    const QDBusMessage request = message();
+    const QDBusConnection bus = connection();
+
+    connect(process, &QProcess::started, process, [process, request, bus] {
+        bus.send(request.createReply(uint(process->processId())));
+    });
+    connect(process, &QProcess::errorOccurred, process, [process, request, bus](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart)
+            bus.send(request.createErrorReply(QDBusError::Failed, process->errorString()));
+    });
+
+    return 0;
+}
+
+void Application::WaitForPhase(const QString &phase)
+{
+    const int wanted = ProcessManager::phaseFromName(phase);
+
+    if (!calledFromDBus())
+        return;
+
+    if (wanted < 0) {
+        sendErrorReply(QDBusError::InvalidArgs, QStringLiteral("Unknown session phase: %1").arg(phase));
+        return;
+    }
+
+    // Phases only move forward, reply right away if it was already reached.
+    if (m_processManager->phase() >= wanted)
+        return;
+
+    setDelayedReply(true);
+    m_phaseWaiters.append(qMakePair(ProcessManager::Phase(wanted), message()));
+}
+
+QVariantMap Application::GetComponentStates() const
+{
+    QVariantMap result;
+    const QMap<QString, QString> states = m_processManager->componentStates();
+    for (auto it = states.constBegin(); it != states.constEnd(); ++it)
+        result.insert(it.key(), it.value());
+    return result;
+}
+
+void Application::notifyPropertyChanged(const QString &property, const QVariant &value)
+{
+    QDBusMessage changed = QDBusMessage::createSignal(QStringLiteral("/Session"),
+                                                      QStringLiteral("org.freedesktop.DBus.Properties"),
+                                                      QStringLiteral("PropertiesChanged"));
+    changed << QStringLiteral("org.prts.Session")
+            << QVariantMap({ { property, value } })
+            << QStringList();
+    QDBusConnection::sessionBus().send(changed);
+}
+
+void Application::onX11ActiveChanged(bool active)
+{
+    emit X11ActiveChanged(active);
+    notifyPropertyChanged(QStringLiteral("X11Active"), active);
+}
+
+void Application::onPhaseChanged(ProcessManager::Phase phase)
+{
+    const QString name = ProcessManager::phaseName(phase);
+    emit StateChanged(name);
+    notifyPropertyChanged(QStringLiteral("State"), name);
+
+    for (auto it = m_phaseWaiters.begin(); it != m_phaseWaiters.end();) {
+        if (it->first <= phase) {
+            QDBusConnection::sessionBus().send(it->second.createReply());
+            it = m_phaseWaiters.erase(it);
+        } else {
+            ++it;
         }
     }
 
-    if (!value.isEmpty()) {
-        qputenv("LANGUAGE", value.toUtf8());
+    if (phase == ProcessManager::Running && m_reexecPending)
+        QTimer::singleShot(0, this, &Application::reexec);
+}
+
+void Application::initEnvironments()
+{
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    SessionEnvironment::addDefaults(environment);
+    SessionEnvironment::apply(environment);
+}
+
+void Application::initDisplaySockets()
+{
+    // Clients started from now on find the compositor through our socket.
+    if (m_processManager->createWaylandSocket())
+        qputenv("WAYLAND_DISPLAY", m_processManager->waylandDisplay().toLocal8Bit());
+
+    // X11 clients get a display whose Xwayland only starts when the first one connects.
+    if (m_processManager->createX11Display()) {
+        qputenv("DISPLAY", m_processManager->x11Display().toLocal8Bit());
+        if (!m_processManager->xauthority().isEmpty())
+            qputenv("XAUTHORITY", QFile::encodeName(m_processManager->xauthority()));
+    } else {
+        qunsetenv("DISPLAY");
     }
 }
 
+void Application::initLanguage()
+{
+    QSettings settings(QSettings::UserScope, "PRTS", "language");
+
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    SessionEnvironment::addLanguage(environment, settings.value("language", "en_US").toString());
+    SessionEnvironment::apply(environment);
+}
+
 static bool isInteger(double x)
 {
     int truncated = (int)x;
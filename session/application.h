@@ -1,18 +1,38 @@
 #ifndef APPLICATION_H
 #define APPLICATION_H
 
-#include <QApplication>
+#include <QCoreApplication>
+#include <QDBusContext>
+#include <QDBusMessage>
+#include <QVariantMap>
 
 #include "processmanager.h"
+#include "sessionmetrics.h"
 #include "powermanager/power.h"
 
-class Application : public QApplication
+class Application : public QCoreApplication, protected QDBusContext
 {
     Q_OBJECT
+    Q_PROPERTY(QString State READ state NOTIFY StateChanged)
+    Q_PROPERTY(bool X11Active READ isX11Active NOTIFY X11ActiveChanged)
 
 public:
     explicit Application(int &argc, char **argv);
 
+    QString state() const
+    {
+        return ProcessManager::phaseName(m_processManager->phase());
+    }
+
+    bool isX11Active() const
+    {
+        return m_processManager->isX11Active();
+    }
+
+signals:
+    void StateChanged(const QString &state);
+    void ComponentStateChanged(const QString &component, const QString &state);
+    void X11ActiveChanged(bool active);
 
 public slots:
     void logout()
@@ -22,12 +42,14 @@ public slots:
 
     void reboot()
     {
+        m_processManager->shutdown();
         m_power.reboot();
         QCoreApplication::exit(0);
     }
 
     void powerOff()
     {
+        m_processManager->shutdown();
         m_power.shutdown();
         QCoreApplication::exit(0);
     }
@@ -37,10 +59,56 @@ public slots:
         m_power.suspend();
     }
 
+    QString GetMetrics()
+    {
+        return QString::fromUtf8(SessionMetrics::self()->exposition());
+    }
+
+    QString WriteMetrics()
+    {
+        return SessionMetrics::self()->writeExposition();
+    }
+
+    uint Launch(const QString &desktopId)
+    {
+        return LaunchWithUrls(desktopId, QStringList());
+    }
+
+    uint LaunchWithUrls(const QString &desktopId, const QStringList &urls);
+
+    /// Re-executes the session binary in place, keeping all children running.
+    /// Deferred until the session reached the running phase.
+    void Reexec();
+
+    /// Called by the KWin window tracker script for every new toplevel window.
+    void WindowShown(const QString &pid, const QString &desktopFileName)
+    {
+        if (calledFromDBus())
+            m_processManager->windowShown(message().service(), pid.toLongLong(), desktopFileName);
+    }
+
+    void WaitForPhase(const QString &phase);
+    QVariantMap GetComponentStates() const;
+
+    QVariantMap GetPowerProviders() const
+    {
+        return m_power.providerHealth();
+    }
+
+private slots:
+    void onPhaseChanged(ProcessManager::Phase phase);
+    void onX11ActiveChanged(bool active);
+
 private:
+    void notifyPropertyChanged(const QString &property, const QVariant &value);
+    void initSignals();
+    void reexec();
+    bool restoreState(int fd);
+
     void initEnvironments();
     void initLanguage();
     void initScreenScaleFactors();
+    void initDisplaySockets();
     bool syncDBusEnvironment();
     void createConfigDirectory();
     int runSync(const QString &program, const QStringList &args, const QStringList &env = {});
@@ -48,6 +116,9 @@ private:
 private:
     ProcessManager *m_processManager;
     Power m_power;
+
+    QList<QPair<ProcessManager::Phase, QDBusMessage>> m_phaseWaiters;
+    bool m_reexecPending;
 };
 
 #endif // APPLICATION_H
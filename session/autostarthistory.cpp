@@ -0,0 +1,278 @@
+#include "autostarthistory.h"
+
+#include <QStandardPaths>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QTimer>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+
+#include <algorithm>
+#include <unistd.h>
+
+static const QByteArray historyMagic("PRTS-AUTOSTART");
+static const quint32 historyVersion = 1;
+
+// Entries are sampled every half second over their first ten seconds.
+static const int sampleInterval = 500;
+static const int sampleWindow = 10 * 1000;
+// An entry using less than a tenth of a CPU over one interval is considered ready.
+static const qint64 idleCpuMsecs = sampleInterval / 10;
+
+static const qint64 heavyCpuMsecs = 1000;
+static const qint64 heavyIoBytes = 32 * 1024 * 1024;
+static const int maxStartupCrashes = 3;
+
+// Weighs a new measurement against the history, recent logins count more.
+static qint64 average(qint64 previous, qint64 value)
+{
+    return previous < 0 ? value : (previous * 3 + value) / 4;
+}
+
+static qint64 processCpuMsecs(qint64 pid)
+{
+    QFile file(QStringLiteral("/proc/%1/stat").arg(pid));
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    const QByteArray stat = file.readAll();
+    const QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 13)
+        return -1;
+
+    // Fields 14 and 15, utime and stime in clock ticks.
+    const qint64 ticks = fields.at(11).toLongLong() + fields.at(12).toLongLong();
+    return ticks * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+static qint64 processIoBytes(qint64 pid)
+{
+    QFile file(QStringLiteral("/proc/%1/io").arg(pid));
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    qint64 bytes = 0;
+    const QList<QByteArray> lines = file.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        if (line.startsWith("read_bytes:") || line.startsWith("write_bytes:"))
+            bytes += line.mid(line.indexOf(':') + 1).trimmed().toLongLong();
+    }
+    return bytes;
+}
+
+AutostartHistory::AutostartHistory(QObject *parent)
+    : QObject(parent)
+    , m_sampleTimer(new QTimer(this))
+    , m_saveTimer(new QTimer(this))
+{
+    m_sampleTimer->setInterval(sampleInterval);
+    connect(m_sampleTimer, &QTimer::timeout, this, &AutostartHistory::sample);
+
+    m_saveTimer->setSingleShot(true);
+    m_saveTimer->setInterval(1000);
+    connect(m_saveTimer, &QTimer::timeout, this, &AutostartHistory::save);
+}
+
+QString AutostartHistory::fileName()
+{
+    QString stateHome = qEnvironmentVariable("XDG_STATE_HOME");
+    if (stateHome.isEmpty())
+        stateHome = QDir::home().absoluteFilePath(QStringLiteral(".local/state"));
+    return stateHome + QStringLiteral("/prts-session/autostart-history");
+}
+
+void AutostartHistory::load()
+{
+    QFile file(fileName());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream in(&file);
+    QByteArray magic;
+    quint32 version;
+    qint32 count;
+    in >> magic >> version >> count;
+
+    if (magic != historyMagic || version != historyVersion) {
+        qWarning() << "Ignoring incompatible autostart history" << file.fileName();
+        return;
+    }
+
+    QHash<QString, Record> records;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString desktopId;
+        Record record;
+        in >> desktopId >> record.readyMsecs >> record.cpuMsecs >> record.ioBytes
+           >> record.startupCrashes >> record.lastCrash;
+        records.insert(desktopId, record);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Ignoring truncated autostart history" << file.fileName();
+        return;
+    }
+
+    m_records = records;
+}
+
+void AutostartHistory::save()
+{
+    const QString path = fileName();
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write autostart history" << path << file.errorString();
+        return;
+    }
+
+    QDataStream out(&file);
+    out << historyMagic << historyVersion << qint32(m_records.size());
+    for (auto it = m_records.constBegin(); it != m_records.constEnd(); ++it) {
+        const Record &record = it.value();
+        out << it.key() << record.readyMsecs << record.cpuMsecs << record.ioBytes
+            << record.startupCrashes << record.lastCrash;
+    }
+
+    file.commit();
+}
+
+void AutostartHistory::scheduleSave()
+{
+    m_saveTimer->start();
+}
+
+qint64 AutostartHistory::cost(const QString &desktopId) const
+{
+    const Record record = m_records.value(desktopId);
+    if (record.cpuMsecs < 0)
+        return 0;
+
+    // One millisecond of CPU weighs as much as 256 KiB of IO or 10 ms of waiting.
+    return record.cpuMsecs + record.ioBytes / (256 * 1024) + record.readyMsecs / 10;
+}
+
+bool AutostartHistory::isHeavy(const QString &desktopId) const
+{
+    const Record record = m_records.value(desktopId);
+    return record.cpuMsecs > heavyCpuMsecs || record.ioBytes > heavyIoBytes;
+}
+
+bool AutostartHistory::isHeldBack(const QString &desktopId, const QDateTime &modified) const
+{
+    const Record record = m_records.value(desktopId);
+    if (record.startupCrashes < maxStartupCrashes)
+        return false;
+
+    // An updated entry deserves another chance.
+    return !modified.isValid() || !record.lastCrash.isValid() || modified <= record.lastCrash;
+}
+
+void AutostartHistory::sort(QStringList &desktopIds) const
+{
+    std::stable_sort(desktopIds.begin(), desktopIds.end(), [this](const QString &a, const QString &b) {
+        return cost(a) < cost(b);
+    });
+}
+
+void AutostartHistory::watch(const QString &desktopId, QProcess *process)
+{
+    Sample sample;
+    sample.desktopId = desktopId;
+    sample.process = process;
+    sample.spawn.start();
+    m_samples.insert(desktopId, sample);
+
+    connect(process, &QProcess::started, this, [this, desktopId, process] {
+        auto it = m_samples.find(desktopId);
+        if (it == m_samples.end())
+            return;
+        it->pid = process->processId();
+        if (!m_sampleTimer->isActive())
+            m_sampleTimer->start();
+    });
+
+    connect(process, &QProcess::errorOccurred, this, [this, desktopId](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart)
+            finish(desktopId, true);
+    });
+
+    connect(process, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), this,
+            [this, desktopId](int exitCode, QProcess::ExitStatus exitStatus) {
+        auto it = m_samples.find(desktopId);
+        if (it == m_samples.end())
+            return;
+
+        // One-shot entries that exit cleanly are ready when they are done.
+        if (it->readyMsecs < 0) {
+            it->readyMsecs = it->spawn.elapsed();
+            emit ready(desktopId);
+        }
+        finish(desktopId, exitStatus == QProcess::CrashExit || exitCode != 0);
+    });
+}
+
+void AutostartHistory::sample()
+{
+    const QStringList desktopIds = m_samples.keys();
+
+    for (const QString &desktopId : desktopIds) {
+        auto it = m_samples.find(desktopId);
+        if (it == m_samples.end() || it->pid <= 0)
+            continue;
+
+        const qint64 cpu = processCpuMsecs(it->pid);
+        const qint64 io = processIoBytes(it->pid);
+
+        bool becameReady = false;
+        if (cpu >= 0) {
+            becameReady = it->readyMsecs < 0 && it->sampled && cpu - it->cpuMsecs < idleCpuMsecs;
+            it->cpuMsecs = cpu;
+            it->sampled = true;
+            if (becameReady)
+                it->readyMsecs = it->spawn.elapsed();
+        }
+        if (io >= 0)
+            it->ioBytes = io;
+
+        const bool done = it->spawn.elapsed() >= sampleWindow;
+        if (becameReady)
+            emit ready(desktopId);
+        if (done)
+            finish(desktopId, false);
+    }
+
+    if (m_samples.isEmpty())
+        m_sampleTimer->stop();
+}
+
+void AutostartHistory::finish(const QString &desktopId, bool crashed)
+{
+    auto it = m_samples.find(desktopId);
+    if (it == m_samples.end())
+        return;
+
+    const Sample sample = *it;
+    m_samples.erase(it);
+
+    Record &record = m_records[desktopId];
+
+    if (crashed) {
+        ++record.startupCrashes;
+        record.lastCrash = QDateTime::currentDateTimeUtc();
+        qWarning() << "Autostart entry failed during startup:" << desktopId << record.startupCrashes << "times in a row";
+    } else {
+        record.startupCrashes = 0;
+        record.readyMsecs = average(record.readyMsecs, sample.readyMsecs >= 0 ? sample.readyMsecs : sampleWindow);
+        record.cpuMsecs = average(record.cpuMsecs, sample.cpuMsecs);
+        record.ioBytes = average(record.ioBytes, sample.ioBytes);
+        qDebug() << "Autostart entry measured:" << desktopId << "ready" << sample.readyMsecs
+                 << "ms, cpu" << sample.cpuMsecs << "ms, io" << sample.ioBytes << "bytes";
+    }
+
+    scheduleSave();
+    emit measured(desktopId);
+}
@@ -0,0 +1,83 @@
+#ifndef AUTOSTARTHISTORY_H
+#define AUTOSTARTHISTORY_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QProcess>
+
+class QTimer;
+
+/*! Launch cost of autostart entries, measured over their first seconds and kept across logins.
+    The next login starts cheap entries first and holds back entries that keep crashing at startup.
+*/
+class AutostartHistory : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Record {
+        /// Averages over past logins, -1 until the entry was measured once.
+        qint64 readyMsecs = -1;
+        qint64 cpuMsecs = -1;
+        qint64 ioBytes = -1;
+        /// Consecutive launches that crashed or failed during the sampling window.
+        qint32 startupCrashes = 0;
+        QDateTime lastCrash;
+    };
+
+    explicit AutostartHistory(QObject *parent = nullptr);
+
+    /// $XDG_STATE_HOME/prts-session/autostart-history
+    static QString fileName();
+
+    void load();
+    void save();
+
+    Record record(const QString &desktopId) const { return m_records.value(desktopId); }
+
+    /// Relative launch cost, 0 for entries that were never measured so they get measured early.
+    qint64 cost(const QString &desktopId) const;
+    /// Entries expensive enough to be started one at a time.
+    bool isHeavy(const QString &desktopId) const;
+    /// True after repeated startup crashes, until the desktop file is modified.
+    bool isHeldBack(const QString &desktopId, const QDateTime &modified) const;
+    /// Orders desktop IDs cheapest first, keeping the scan order for equal costs.
+    void sort(QStringList &desktopIds) const;
+
+    /// Samples the process from now until it is ready or the sampling window ends.
+    void watch(const QString &desktopId, QProcess *process);
+
+signals:
+    /// Emitted once a watched entry went idle after its startup, or exited.
+    void ready(const QString &desktopId);
+    /// Emitted when the sampling window of a watched entry ended, by timeout or exit.
+    void measured(const QString &desktopId);
+
+private slots:
+    void sample();
+
+private:
+    struct Sample {
+        QString desktopId;
+        QPointer<QProcess> process;
+        qint64 pid = 0;
+        QElapsedTimer spawn;
+        qint64 readyMsecs = -1;
+        qint64 cpuMsecs = 0;
+        qint64 ioBytes = 0;
+        bool sampled = false;
+    };
+
+    void finish(const QString &desktopId, bool crashed);
+    void scheduleSave();
+
+    QHash<QString, Record> m_records;
+    QHash<QString, Sample> m_samples;
+    QTimer *m_sampleTimer;
+    QTimer *m_saveTimer;
+};
+
+#endif // AUTOSTARTHISTORY_H
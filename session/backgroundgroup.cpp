@@ -0,0 +1,108 @@
+#include "backgroundgroup.h"
+
+#include <QFileInfo>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+
+#include <cmath>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static const QString cgroupRoot = QStringLiteral("/sys/fs/cgroup");
+
+static QString ownCgroup()
+{
+    QFile file(QStringLiteral("/proc/self/cgroup"));
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    // The unified hierarchy is the "0::" line.
+    const QList<QByteArray> lines = file.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        if (line.startsWith("0::"))
+            return cgroupRoot + QString::fromUtf8(line.mid(3));
+    }
+    return QString();
+}
+
+BackgroundGroup::BackgroundGroup()
+    : m_weight(100)
+{
+}
+
+bool BackgroundGroup::writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+bool BackgroundGroup::init()
+{
+    QString base = ownCgroup();
+    if (base.isEmpty())
+        return false;
+
+    // After a re-exec the session already sits in its own leaf.
+    if (QFileInfo(base).fileName() == QLatin1String("session")
+            && QFileInfo::exists(QFileInfo(base).path() + QStringLiteral("/background")))
+        base = QFileInfo(base).path();
+
+    if (!QFileInfo(base + QStringLiteral("/cgroup.subtree_control")).isWritable())
+        return false;
+
+    QFile controllers(base + QStringLiteral("/cgroup.controllers"));
+    if (!controllers.open(QIODevice::ReadOnly) || !controllers.readAll().split(' ').contains("cpu"))
+        return false;
+
+    // cgroup v2 allows no processes in inner groups, the session moves into a leaf first.
+    const QString session = base + QStringLiteral("/session");
+    const QString background = base + QStringLiteral("/background");
+    if (!QDir().mkpath(session) || !QDir().mkpath(background)
+            || !writeFile(session + QStringLiteral("/cgroup.procs"), QByteArray::number(qint64(::getpid())))
+            || !writeFile(base + QStringLiteral("/cgroup.subtree_control"), "+cpu")) {
+        qWarning() << "Cgroup" << base << "is not delegated, using nice values for background processes";
+        return false;
+    }
+
+    m_path = background;
+    writeFile(m_path + QStringLiteral("/cpu.weight"), QByteArray::number(m_weight));
+    qDebug() << "Background processes run in" << m_path;
+    return true;
+}
+
+void BackgroundGroup::add(qint64 pid)
+{
+    if (pid <= 0)
+        return;
+
+    m_pids.insert(pid);
+
+    if (isDelegated())
+        writeFile(m_path + QStringLiteral("/cgroup.procs"), QByteArray::number(pid));
+    else
+        applyNice(pid);
+}
+
+void BackgroundGroup::applyNice(qint64 pid) const
+{
+    // The kernel scales cpu.weight by about 1.25 per nice level.
+    // Without CAP_SYS_NICE a raised nice value cannot be lowered again.
+    const int nice = qBound(0, int(std::lround(std::log(100.0 / m_weight) / std::log(1.25))), 19);
+    ::setpriority(PRIO_PROCESS, id_t(pid), nice);
+}
+
+void BackgroundGroup::setWeight(int weight)
+{
+    if (weight == m_weight)
+        return;
+    m_weight = weight;
+
+    if (isDelegated()) {
+        writeFile(m_path + QStringLiteral("/cpu.weight"), QByteArray::number(m_weight));
+        return;
+    }
+
+    for (qint64 pid : qAsConst(m_pids))
+        applyNice(pid);
+}
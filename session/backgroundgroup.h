@@ -0,0 +1,35 @@
+#ifndef BACKGROUNDGROUP_H
+#define BACKGROUNDGROUP_H
+
+#include <QSet>
+#include <QString>
+
+/*! CPU share of background processes: autostart entries and components marked Background.
+    With a delegated cgroup v2 subtree they live in a "background" child group whose cpu.weight
+    is changed live. Otherwise each process gets a nice value approximating the weight.
+*/
+class BackgroundGroup
+{
+public:
+    BackgroundGroup();
+
+    /// Sets up the child groups, call it before any child process is started.
+    bool init();
+    bool isDelegated() const { return !m_path.isEmpty(); }
+
+    void add(qint64 pid);
+    void remove(qint64 pid) { m_pids.remove(pid); }
+
+    int weight() const { return m_weight; }
+    void setWeight(int weight);
+
+private:
+    static bool writeFile(const QString &path, const QByteArray &data);
+    void applyNice(qint64 pid) const;
+
+    QString m_path;
+    QSet<qint64> m_pids;
+    int m_weight;
+};
+
+#endif // BACKGROUNDGROUP_H
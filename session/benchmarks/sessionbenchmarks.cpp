@@ -0,0 +1,238 @@
+#include "desktopfile.h"
+#include "process.h"
+#include "processmanager.h"
+#include "sessionenvironment.h"
+#include "powermanager/power.h"
+#include "powermanager/powerproviders.h"
+
+#include <QCoreApplication>
+#include <QTemporaryDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QDir>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+// Autostart datasets from a bare install up to a heavily customized account.
+static void autostartSizes(benchmark::internal::Benchmark *benchmark)
+{
+    for (int entries : { 10, 50, 200, 1000, 5000 })
+        benchmark->Arg(entries);
+}
+
+/*! A user and a system autostart directory with entries like the ones found in the wild:
+    translated names, desktop restrictions, disabled and hidden entries. A quarter of the
+    system entries are overridden by the user.
+*/
+class AutostartDataset
+{
+public:
+    explicit AutostartDataset(int count)
+    {
+        QDir(m_dir.path()).mkpath(QStringLiteral("user"));
+        QDir(m_dir.path()).mkpath(QStringLiteral("system"));
+
+        for (int i = 0; i < count; ++i) {
+            const bool user = i % 4 == 0;
+            write(QStringLiteral("system"), i);
+            if (user)
+                write(QStringLiteral("user"), i);
+        }
+    }
+
+    QStringList dirs() const
+    {
+        return QStringList { m_dir.filePath(QStringLiteral("user")), m_dir.filePath(QStringLiteral("system")) };
+    }
+
+private:
+    void write(const QString &dir, int i)
+    {
+        QByteArray data = "[Desktop Entry]\nType=Application\n";
+        data += "Name=Autostart Entry " + QByteArray::number(i) + '\n';
+        for (const char *locale : { "de", "fr", "ja", "zh_CN", "ru", "pt_BR" })
+            data += "Name[" + QByteArray(locale) + "]=Autostart Entry " + QByteArray::number(i) + '\n';
+        data += "Comment=Synthetic entry for benchmarks\n";
+        data += "Icon=application-x-executable\n";
+        data += "Exec=/usr/bin/entry-" + QByteArray::number(i) + " --autostart --config \"/tmp/entry config\" %U\n";
+
+        switch (i % 8) {
+        case 1: data += "OnlyShowIn=PRTS;KDE;\n"; break;
+        case 2: data += "NotShowIn=GNOME;XFCE;\n"; break;
+        case 3: data += "X-GNOME-Autostart-enabled=false\n"; break;
+        case 4: data += "Hidden=true\n"; break;
+        case 5: data += "X-PRTS-Deferrable=true\n"; break;
+        default: break;
+        }
+
+        data += "\n[Desktop Action settings]\nName=Settings\nExec=/usr/bin/entry-" + QByteArray::number(i) + " --settings\n";
+
+        QFile file(m_dir.filePath(dir + QStringLiteral("/entry-%1.desktop").arg(i)));
+        if (file.open(QIODevice::WriteOnly))
+            file.write(data);
+    }
+
+    QTemporaryDir m_dir;
+};
+
+static void BM_AutostartScan(benchmark::State &state)
+{
+    const AutostartDataset dataset(int(state.range(0)));
+    const QStringList dirs = dataset.dirs();
+
+    for (auto _ : state) {
+        const QMap<QString, DesktopFile> entries = ProcessManager::readAutoStartEntries(dirs);
+        benchmark::DoNotOptimize(entries);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_AutostartScan)->Apply(autostartSizes)->Unit(benchmark::kMicrosecond);
+
+// The filtering loadAutoStartProcess() does on every entry that was read.
+static void BM_AutostartFilter(benchmark::State &state)
+{
+    const AutostartDataset dataset(int(state.range(0)));
+    const QMap<QString, DesktopFile> entries = ProcessManager::readAutoStartEntries(dataset.dirs());
+    const QString desktop = QStringLiteral("PRTS");
+
+    for (auto _ : state) {
+        QStringList order;
+        for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+            const DesktopFile &entry = it.value();
+            if (!entry.isValid() || !entry.isShownIn(desktop) || entry.execArguments().isEmpty())
+                continue;
+            order << it.key().chopped(8);
+        }
+        benchmark::DoNotOptimize(order);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_AutostartFilter)->Apply(autostartSizes)->Unit(benchmark::kMicrosecond);
+
+static void BM_DesktopFileParse(benchmark::State &state)
+{
+    const AutostartDataset dataset(1);
+    QFile file(dataset.dirs().constLast() + QStringLiteral("/entry-0.desktop"));
+    file.open(QIODevice::ReadOnly);
+    const QByteArray data = file.readAll();
+
+    for (auto _ : state) {
+        DesktopFile entry = DesktopFile::fromData(data);
+        benchmark::DoNotOptimize(entry);
+    }
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_DesktopFileParse);
+
+// Environment construction at login, on top of an inherited environment of the given size.
+static void BM_EnvironmentConstruction(benchmark::State &state)
+{
+    QProcessEnvironment base;
+    for (int i = 0; i < state.range(0); ++i)
+        base.insert(QStringLiteral("INHERITED_VARIABLE_%1").arg(i), QStringLiteral("/some/inherited/value/%1").arg(i));
+
+    for (auto _ : state) {
+        QProcessEnvironment environment = base;
+        SessionEnvironment::addDefaults(environment);
+        SessionEnvironment::addLanguage(environment, QStringLiteral("en_US"));
+        // What every QProcess::start() does with it.
+        benchmark::DoNotOptimize(environment.toStringList());
+    }
+}
+BENCHMARK(BM_EnvironmentConstruction)->Arg(10)->Arg(50)->Arg(200)->Arg(1000);
+
+// Starts a batch of short-lived children and waits until every one of them was reaped.
+static void BM_SpawnReap(benchmark::State &state)
+{
+    const int count = int(state.range(0));
+
+    for (auto _ : state) {
+        QEventLoop loop;
+        int running = count;
+        std::vector<std::unique_ptr<Process>> processes;
+        processes.reserve(size_t(count));
+
+        for (int i = 0; i < count; ++i) {
+            processes.emplace_back(new Process);
+            Process *process = processes.back().get();
+            QObject::connect(process, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), &loop, [&] {
+                if (--running == 0)
+                    loop.quit();
+            });
+            QObject::connect(process, &QProcess::errorOccurred, &loop, [&](QProcess::ProcessError error) {
+                if (error == QProcess::FailedToStart && --running == 0)
+                    loop.quit();
+            });
+            process->start(QStringLiteral("/bin/true"), QStringList());
+        }
+
+        if (running > 0)
+            loop.exec();
+    }
+
+    state.SetItemsProcessed(state.iterations() * count);
+}
+// Capped below the autostart sizes, thousands of concurrent children hit RLIMIT_NPROC.
+BENCHMARK(BM_SpawnReap)->Arg(10)->Arg(50)->Arg(200)->Arg(1000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/*! Answers without D-Bus, so only the dispatch in Power is measured. */
+class FakeProvider : public PowerProvider
+{
+public:
+    explicit FakeProvider(bool can)
+        : m_can(can)
+    {
+    }
+
+    bool canAction(Power::Action action) override
+    {
+        Q_UNUSED(action)
+        return m_can;
+    }
+
+    QString name() const override { return QStringLiteral("fake"); }
+
+    bool doAction(Power::Action action) override
+    {
+        Q_UNUSED(action)
+        return m_can;
+    }
+
+private:
+    bool m_can;
+};
+
+// Dispatch when only the last of the given number of providers supports the action.
+static void BM_PowerDispatch(benchmark::State &state)
+{
+    QList<PowerProvider *> providers;
+    for (int i = 1; i < state.range(0); ++i)
+        providers << new FakeProvider(false);
+    providers << new FakeProvider(true);
+
+    Power power(providers);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(power.canAction(Power::PowerSuspend));
+        benchmark::DoNotOptimize(power.doAction(Power::PowerMonitorOff));
+    }
+}
+BENCHMARK(BM_PowerDispatch)->Arg(1)->Arg(3)->Arg(8);
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
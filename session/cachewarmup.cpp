@@ -0,0 +1,249 @@
+#include "cachewarmup.h"
+#include "desktopfile.h"
+#include "sessionmetrics.h"
+
+#include <QStandardPaths>
+#include <QDirIterator>
+#include <QThreadPool>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QProcess>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From linux/ioprio.h, which is not always installed.
+static const int ioprioWhoProcess = 1;
+static const int ioprioClassIdle = 3;
+static const int ioprioClassShift = 13;
+
+static QStringList splitDirs(const QString &value)
+{
+    return value.split(QLatin1Char(':'), Qt::SkipEmptyParts);
+}
+
+// Newest modification time of the directories themselves, enough to notice added or removed files.
+static QDateTime newestDirectory(const QStringList &dirs, bool recursive)
+{
+    QDateTime newest;
+
+    for (const QString &dir : dirs) {
+        const QFileInfo info(dir);
+        if (!info.isDir())
+            continue;
+        if (!newest.isValid() || info.lastModified() > newest)
+            newest = info.lastModified();
+        if (!recursive)
+            continue;
+
+        QDirIterator it(dir, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            if (it.fileInfo().lastModified() > newest)
+                newest = it.fileInfo().lastModified();
+        }
+    }
+
+    return newest;
+}
+
+static QStringList filesIn(const QString &dir, const QStringList &filters)
+{
+    QStringList files;
+    const QFileInfoList entries = QDir(dir).entryInfoList(filters, QDir::Files);
+    for (const QFileInfo &entry : entries)
+        files << entry.absoluteFilePath();
+    return files;
+}
+
+static QDateTime newest(const QStringList &files)
+{
+    QDateTime result;
+    for (const QString &file : files) {
+        const QDateTime modified = QFileInfo(file).lastModified();
+        if (!result.isValid() || modified > result)
+            result = modified;
+    }
+    return result;
+}
+
+static void warmFontconfig(const QProcessEnvironment &env)
+{
+    const QString dataHome = env.value(QStringLiteral("XDG_DATA_HOME"));
+    QStringList fontDirs = { QStringLiteral("/usr/share/fonts"), QStringLiteral("/usr/local/share/fonts"),
+                             dataHome + QStringLiteral("/fonts"), QDir::homePath() + QStringLiteral("/.fonts") };
+
+    const QString userCache = env.value(QStringLiteral("XDG_CACHE_HOME")) + QStringLiteral("/fontconfig");
+    const QStringList caches = filesIn(userCache, { QStringLiteral("*.cache-*") })
+            + filesIn(QStringLiteral("/var/cache/fontconfig"), { QStringLiteral("*.cache-*") });
+
+    // fc-cache checks every directory against its own cache and only rebuilds stale ones,
+    // it is only worth starting when some font directory changed after the last cache write.
+    const QDateTime fonts = newestDirectory(fontDirs, true);
+    if (caches.isEmpty() || (fonts.isValid() && fonts > newest(caches))) {
+        CacheWarmup::regenerate(QStringLiteral("fc-cache"), QStringList(), env);
+        return;
+    }
+
+    CacheWarmup::prefetch(caches);
+}
+
+static void warmIconThemes(const QProcessEnvironment &env)
+{
+    const QString dataHome = env.value(QStringLiteral("XDG_DATA_HOME"));
+    const QStringList dataDirs = QStringList(dataHome) + splitDirs(env.value(QStringLiteral("XDG_DATA_DIRS")));
+
+    const DesktopFile kdeglobals = DesktopFile::fromFile(env.value(QStringLiteral("XDG_CONFIG_HOME"))
+                                                         + QStringLiteral("/kdeglobals"));
+    const QStringList themes = { kdeglobals.value(QStringLiteral("Theme"), QStringLiteral("Icons"), QStringLiteral("breeze")),
+                                 QStringLiteral("hicolor") };
+
+    QStringList valid;
+    for (const QString &theme : themes) {
+        for (const QString &dataDir : dataDirs) {
+            const QString themeDir = dataDir + QStringLiteral("/icons/") + theme;
+            const QString cache = themeDir + QStringLiteral("/icon-theme.cache");
+            if (!QFileInfo(themeDir).isDir())
+                continue;
+
+            const QDateTime icons = newestDirectory({ themeDir }, true);
+            const bool stale = !QFileInfo::exists(cache) || icons > QFileInfo(cache).lastModified();
+
+            // Only the user's own themes can be regenerated without privileges.
+            if (stale && dataDir == dataHome && QFileInfo::exists(themeDir + QStringLiteral("/index.theme")))
+                CacheWarmup::regenerate(QStringLiteral("gtk-update-icon-cache"), { QStringLiteral("-q"), themeDir }, env);
+            else if (!stale)
+                valid << cache;
+        }
+    }
+
+    CacheWarmup::prefetch(valid);
+}
+
+static void warmMimeDatabase(const QProcessEnvironment &env)
+{
+    const QString dataHome = env.value(QStringLiteral("XDG_DATA_HOME"));
+    const QStringList dataDirs = QStringList(dataHome) + splitDirs(env.value(QStringLiteral("XDG_DATA_DIRS")));
+
+    QStringList valid;
+    for (const QString &dataDir : dataDirs) {
+        const QString mimeDir = dataDir + QStringLiteral("/mime");
+        const QString cache = mimeDir + QStringLiteral("/mime.cache");
+        const QDateTime packages = newestDirectory({ mimeDir + QStringLiteral("/packages") }, false);
+        if (!packages.isValid())
+            continue;
+
+        const bool stale = !QFileInfo::exists(cache) || packages > QFileInfo(cache).lastModified();
+        if (stale && dataDir == dataHome)
+            CacheWarmup::regenerate(QStringLiteral("update-mime-database"), { mimeDir }, env);
+        else if (!stale)
+            valid << cache;
+    }
+
+    CacheWarmup::prefetch(valid);
+}
+
+static void warmSycoca(const QProcessEnvironment &env)
+{
+    const QString dataHome = env.value(QStringLiteral("XDG_DATA_HOME"));
+    QStringList applicationDirs;
+    for (const QString &dataDir : QStringList(dataHome) + splitDirs(env.value(QStringLiteral("XDG_DATA_DIRS"))))
+        applicationDirs << dataDir + QStringLiteral("/applications");
+
+    const QStringList caches = filesIn(env.value(QStringLiteral("XDG_CACHE_HOME")), { QStringLiteral("ksycoca6_*") });
+    const QDateTime applications = newestDirectory(applicationDirs, true);
+
+    // There is one ksycoca6_* per language and configuration, some of them are always out of date.
+    // The one in use is rewritten whenever an application is installed, compare against the newest.
+    if (caches.isEmpty() || (applications.isValid() && applications > newest(caches))) {
+        if (!QStandardPaths::findExecutable(QStringLiteral("kbuildsycoca6")).isEmpty())
+            CacheWarmup::regenerate(QStringLiteral("kbuildsycoca6"), QStringList(), env);
+        return;
+    }
+
+    CacheWarmup::prefetch(caches);
+}
+
+CacheWarmup::CacheWarmup(QObject *parent)
+    : QObject(parent)
+    , m_pool(new QThreadPool(this))
+    , m_pending(0)
+{
+    m_pool->setMaxThreadCount(4);
+    m_pool->setThreadPriority(QThread::IdlePriority);
+}
+
+CacheWarmup::~CacheWarmup()
+{
+    m_pool->clear();
+    m_pool->waitForDone();
+}
+
+void CacheWarmup::start(const QProcessEnvironment &environment)
+{
+    if (isRunning())
+        return;
+
+    m_timer.start();
+    run("fontconfig", [environment] { warmFontconfig(environment); });
+    run("icons", [environment] { warmIconThemes(environment); });
+    run("mime", [environment] { warmMimeDatabase(environment); });
+    run("ksycoca", [environment] { warmSycoca(environment); });
+}
+
+void CacheWarmup::run(const char *name, const std::function<void()> &task)
+{
+    ++m_pending;
+    MetricHistogram *duration = SessionMetrics::self()->histogram("prts_session_cache_warmup_seconds",
+                                                                  "Time taken to check and warm up a cache at login.",
+                                                                  SessionMetrics::label("cache", QLatin1String(name)));
+
+    m_pool->start([this, task, duration] {
+        QElapsedTimer timer;
+        timer.start();
+        task();
+        duration->observe(timer);
+
+        QMetaObject::invokeMethod(this, [this] {
+            if (--m_pending > 0)
+                return;
+            qDebug() << "Cache warm-up finished in" << m_timer.elapsed() << "ms";
+            emit finished();
+        }, Qt::QueuedConnection);
+    });
+}
+
+void CacheWarmup::prefetch(const QStringList &files)
+{
+    for (const QString &file : files) {
+        const int fd = ::open(QFile::encodeName(file).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        ::close(fd);
+    }
+}
+
+bool CacheWarmup::regenerate(const QString &program, const QStringList &arguments,
+                             const QProcessEnvironment &environment)
+{
+    if (QStandardPaths::findExecutable(program).isEmpty())
+        return false;
+
+    qDebug() << "Regenerating stale cache:" << program << arguments;
+
+    QProcess process;
+    process.setProcessChannelMode(QProcess::ForwardedChannels);
+    process.setProcessEnvironment(environment);
+    process.setChildProcessModifier([] {
+        ::syscall(SYS_ioprio_set, ioprioWhoProcess, 0, ioprioClassIdle << ioprioClassShift);
+        ::setpriority(PRIO_PROCESS, 0, 19);
+    });
+    process.start(program, arguments);
+    return process.waitForFinished(-1) && process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0;
+}
@@ -0,0 +1,46 @@
+#ifndef CACHEWARMUP_H
+#define CACHEWARMUP_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QProcessEnvironment>
+#include <QStringList>
+
+#include <functional>
+
+class QThreadPool;
+
+/*! Login stage that gets per-user caches ready while the compositor starts:
+    fontconfig, icon theme caches, the MIME database and ksycoca.
+    Stale caches are regenerated at idle IO priority, valid ones are read ahead into the page cache.
+*/
+class CacheWarmup : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CacheWarmup(QObject *parent = nullptr);
+    ~CacheWarmup() override;
+
+    /// Runs all checks in parallel on a private thread pool, finished() follows.
+    void start(const QProcessEnvironment &environment);
+    bool isRunning() const { return m_pending > 0; }
+
+    /// Asks the kernel to read the files into the page cache without waiting for it.
+    static void prefetch(const QStringList &files);
+    /// Runs program at idle IO and lowest CPU priority, blocking the calling thread.
+    static bool regenerate(const QString &program, const QStringList &arguments,
+                           const QProcessEnvironment &environment);
+
+signals:
+    void finished();
+
+private:
+    void run(const char *name, const std::function<void()> &task);
+
+    QThreadPool *m_pool;
+    QElapsedTimer m_timer;
+    int m_pending;
+};
+
+#endif // CACHEWARMUP_H
@@ -0,0 +1,286 @@
+#include "desktopfile.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QUrl>
+
+static QString unescape(const QString &value, bool list = false)
+{
+    if (!value.contains(QLatin1Char('\\')))
+        return value;
+
+    QString result;
+    result.reserve(value.size());
+
+    for (int i = 0; i < value.size(); ++i) {
+        const QChar c = value.at(i);
+        if (c != QLatin1Char('\\') || i + 1 == value.size()) {
+            result += c;
+            continue;
+        }
+
+        const QChar next = value.at(++i);
+        switch (next.unicode()) {
+        case 's': result += QLatin1Char(' '); break;
+        case 'n': result += QLatin1Char('\n'); break;
+        case 't': result += QLatin1Char('\t'); break;
+        case 'r': result += QLatin1Char('\r'); break;
+        case '\\': result += QLatin1Char('\\'); break;
+        case ';':
+            // Keep escaped separators for stringList() to handle.
+            if (list)
+                result += QLatin1Char('\\');
+            result += next;
+            break;
+        default:
+            result += QLatin1Char('\\');
+            result += next;
+            break;
+        }
+    }
+
+    return result;
+}
+
+static QString localFile(const QString &url)
+{
+    const QUrl u(url);
+    return u.isLocalFile() ? u.toLocalFile() : url;
+}
+
+DesktopFile DesktopFile::fromFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return DesktopFile();
+
+    return fromData(file.readAll(), path);
+}
+
+DesktopFile DesktopFile::fromData(const QByteArray &data, const QString &path)
+{
+    DesktopFile result;
+    result.m_fileName = path;
+
+    QHash<QString, QString> *group = nullptr;
+    int start = 0;
+
+    while (start < data.size()) {
+        int end = data.indexOf('\n', start);
+        if (end < 0)
+            end = data.size();
+
+        const QByteArray line = data.mid(start, end - start).trimmed();
+        start = end + 1;
+
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        if (line.startsWith('[')) {
+            const int close = line.indexOf(']');
+            if (close < 0) {
+                group = nullptr;
+                continue;
+            }
+            const QString name = QString::fromUtf8(line.mid(1, close - 1));
+            // Duplicate groups are invalid, the first one wins.
+            if (result.m_groups.contains(name)) {
+                group = nullptr;
+            } else {
+                result.m_groupOrder << name;
+                group = &result.m_groups[name];
+            }
+            continue;
+        }
+
+        const int eq = line.indexOf('=');
+        if (!group || eq <= 0)
+            continue;
+
+        const QString key = QString::fromUtf8(line.left(eq).trimmed());
+        if (!group->contains(key))
+            group->insert(key, QString::fromUtf8(line.mid(eq + 1).trimmed()));
+    }
+
+    return result;
+}
+
+bool DesktopFile::contains(const QString &key, const QString &group) const
+{
+    const auto it = m_groups.constFind(group);
+    return it != m_groups.constEnd() && it->contains(key);
+}
+
+QString DesktopFile::value(const QString &key, const QString &group, const QString &defaultValue) const
+{
+    const auto it = m_groups.constFind(group);
+    if (it == m_groups.constEnd())
+        return defaultValue;
+
+    const auto value = it->constFind(key);
+    return value == it->constEnd() ? defaultValue : unescape(*value);
+}
+
+QStringList DesktopFile::stringList(const QString &key, const QString &group) const
+{
+    const auto it = m_groups.constFind(group);
+    if (it == m_groups.constEnd() || !it->contains(key))
+        return QStringList();
+
+    const QString raw = unescape(it->value(key), true);
+    QStringList result;
+    QString current;
+
+    for (int i = 0; i < raw.size(); ++i) {
+        const QChar c = raw.at(i);
+        if (c == QLatin1Char('\\') && i + 1 < raw.size() && raw.at(i + 1) == QLatin1Char(';')) {
+            current += QLatin1Char(';');
+            ++i;
+        } else if (c == QLatin1Char(';')) {
+            result << current;
+            current.clear();
+        } else {
+            current += c;
+        }
+    }
+
+    if (!current.isEmpty())
+        result << current;
+
+    return result;
+}
+
+bool DesktopFile::boolValue(const QString &key, bool defaultValue, const QString &group) const
+{
+    if (!contains(key, group))
+        return defaultValue;
+
+    const QString v = value(key, group);
+    return v == QLatin1String("true") || v == QLatin1String("1");
+}
+
+bool DesktopFile::isShownIn(const QString &desktop) const
+{
+    if (boolValue(QStringLiteral("Hidden")))
+        return false;
+
+    const QStringList current = desktop.split(QLatin1Char(':'), Qt::SkipEmptyParts);
+    const QStringList onlyShowIn = stringList(QStringLiteral("OnlyShowIn"));
+    const QStringList notShowIn = stringList(QStringLiteral("NotShowIn"));
+
+    for (const QString &d : current) {
+        if (notShowIn.contains(d))
+            return false;
+    }
+
+    if (onlyShowIn.isEmpty())
+        return true;
+
+    for (const QString &d : current) {
+        if (onlyShowIn.contains(d))
+            return true;
+    }
+
+    return false;
+}
+
+bool DesktopFile::isLaunchable() const
+{
+    if (boolValue(QStringLiteral("Hidden")))
+        return false;
+
+    const QString tryExec = value(QStringLiteral("TryExec"));
+    if (tryExec.isEmpty())
+        return true;
+
+    if (QFileInfo(tryExec).isAbsolute())
+        return QFileInfo(tryExec).isExecutable();
+
+    return !QStandardPaths::findExecutable(tryExec).isEmpty();
+}
+
+QStringList DesktopFile::splitExec(const QString &exec)
+{
+    QStringList args;
+    QString current;
+    bool quoted = false;
+    bool hasArg = false;
+
+    for (int i = 0; i < exec.size(); ++i) {
+        const QChar c = exec.at(i);
+
+        if (c == QLatin1Char('\\') && i + 1 < exec.size()) {
+            current += exec.at(++i);
+            hasArg = true;
+        } else if (c == QLatin1Char('"')) {
+            quoted = !quoted;
+            hasArg = true;
+        } else if (c.isSpace() && !quoted) {
+            if (hasArg)
+                args << current;
+            current.clear();
+            hasArg = false;
+        } else {
+            current += c;
+            hasArg = true;
+        }
+    }
+
+    if (hasArg)
+        args << current;
+
+    return args;
+}
+
+QStringList DesktopFile::execArguments(const QStringList &urls) const
+{
+    const QStringList tokens = splitExec(value(QStringLiteral("Exec")));
+    QStringList args;
+
+    for (const QString &token : tokens) {
+        if (token == QLatin1String("%F")) {
+            for (const QString &url : urls)
+                args << localFile(url);
+            continue;
+        }
+        if (token == QLatin1String("%U")) {
+            args << urls;
+            continue;
+        }
+        if (token == QLatin1String("%i")) {
+            const QString icon = value(QStringLiteral("Icon"));
+            if (!icon.isEmpty())
+                args << QStringLiteral("--icon") << icon;
+            continue;
+        }
+
+        QString arg;
+        bool hadFieldCode = false;
+
+        for (int i = 0; i < token.size(); ++i) {
+            const QChar c = token.at(i);
+            if (c != QLatin1Char('%') || i + 1 == token.size()) {
+                arg += c;
+                continue;
+            }
+
+            hadFieldCode = true;
+            switch (token.at(++i).unicode()) {
+            case '%': arg += QLatin1Char('%'); break;
+            case 'f': if (!urls.isEmpty()) arg += localFile(urls.constFirst()); break;
+            case 'u': if (!urls.isEmpty()) arg += urls.constFirst(); break;
+            case 'c': arg += value(QStringLiteral("Name")); break;
+            case 'k': arg += m_fileName; break;
+            default:
+                // Deprecated or unknown field codes are dropped.
+                break;
+            }
+        }
+
+        if (!arg.isEmpty() || !hadFieldCode)
+            args << arg;
+    }
+
+    return args;
+}
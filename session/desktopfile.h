@@ -0,0 +1,52 @@
+#ifndef DESKTOPFILE_H
+#define DESKTOPFILE_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+/*! Minimal reader for freedesktop.org key files (.desktop entries and similar).
+    Unlike QSettings it keeps ';' separated lists and Exec lines intact,
+    and it only reads the file once.
+*/
+class DesktopFile
+{
+public:
+    DesktopFile() = default;
+
+    /// Parses the file at path, returns an invalid object if it cannot be read.
+    static DesktopFile fromFile(const QString &path);
+    /// Parses key file data already in memory.
+    static DesktopFile fromData(const QByteArray &data, const QString &path = QString());
+
+    bool isValid() const { return !m_groups.isEmpty(); }
+    QString fileName() const { return m_fileName; }
+
+    /// Returns the group names in the order they appear in the file.
+    QStringList groups() const { return m_groupOrder; }
+    bool contains(const QString &key, const QString &group = desktopEntryGroup()) const;
+    QString value(const QString &key, const QString &group = desktopEntryGroup(),
+                  const QString &defaultValue = QString()) const;
+    QStringList stringList(const QString &key, const QString &group = desktopEntryGroup()) const;
+    bool boolValue(const QString &key, bool defaultValue = false,
+                   const QString &group = desktopEntryGroup()) const;
+
+    /// Returns true if the entry should be started or listed in the current desktop.
+    bool isShownIn(const QString &desktop) const;
+    /// Returns false if the entry is Hidden or its TryExec program cannot be found.
+    bool isLaunchable() const;
+
+    /*! Splits the Exec key into program and arguments, expanding field codes.
+        \param urls local files or URLs passed to %f, %F, %u and %U. */
+    QStringList execArguments(const QStringList &urls = QStringList()) const;
+
+    static QString desktopEntryGroup() { return QStringLiteral("Desktop Entry"); }
+    static QStringList splitExec(const QString &exec);
+
+private:
+    QString m_fileName;
+    QStringList m_groupOrder;
+    QHash<QString, QHash<QString, QString>> m_groups;
+};
+
+#endif // DESKTOPFILE_H
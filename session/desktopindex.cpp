@@ -0,0 +1,102 @@
+#include "desktopindex.h"
+
+#include <QFileSystemWatcher>
+#include <QStandardPaths>
+#include <QFileInfo>
+#include <QDebug>
+#include <QDir>
+
+DesktopIndex::DesktopIndex(QObject *parent)
+    : QObject(parent)
+    , m_watcher(new QFileSystemWatcher(this))
+    , m_dirty(true)
+{
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &DesktopIndex::invalidate);
+}
+
+DesktopFile DesktopIndex::find(const QString &desktopId)
+{
+    if (m_dirty)
+        rebuild();
+
+    QString id = desktopId;
+    if (!id.endsWith(QLatin1String(".desktop")))
+        id += QLatin1String(".desktop");
+
+    const QString path = m_paths.value(id);
+    if (path.isEmpty())
+        return DesktopFile();
+
+    const QDateTime modified = QFileInfo(path).lastModified();
+    auto it = m_entries.find(path);
+    if (it == m_entries.end() || it->modified != modified) {
+        CachedEntry entry;
+        entry.modified = modified;
+        entry.file = DesktopFile::fromFile(path);
+        it = m_entries.insert(path, entry);
+    }
+
+    return it->file;
+}
+
+QString DesktopIndex::desktopId(const QString &path)
+{
+    if (m_dirty)
+        rebuild();
+
+    for (auto it = m_paths.constBegin(); it != m_paths.constEnd(); ++it) {
+        if (it.value() == path)
+            return it.key();
+    }
+
+    return QString();
+}
+
+void DesktopIndex::invalidate()
+{
+    m_dirty = true;
+}
+
+void DesktopIndex::rebuild()
+{
+    m_dirty = false;
+    m_paths.clear();
+
+    if (!m_watcher->directories().isEmpty())
+        m_watcher->removePaths(m_watcher->directories());
+
+    // Directories are in order of precedence, the first entry with a given ID wins.
+    const QStringList dirs = QStandardPaths::standardLocations(QStandardPaths::ApplicationsLocation);
+    for (const QString &dir : dirs)
+        scan(dir, dir);
+
+    qDebug() << "Desktop index rebuilt with" << m_paths.size() << "entries";
+}
+
+void DesktopIndex::scan(const QString &root, const QString &dir)
+{
+    const QDir d(dir);
+    if (!d.exists())
+        return;
+
+    m_watcher->addPath(dir);
+
+    const QFileInfoList entries = d.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QFileInfo &info : entries) {
+        if (info.isDir()) {
+            scan(root, info.absoluteFilePath());
+            continue;
+        }
+
+        if (info.suffix() != QLatin1String("desktop"))
+            continue;
+
+        QString id = info.absoluteFilePath().mid(root.size());
+        while (id.startsWith(QLatin1Char('/')))
+            id.remove(0, 1);
+        id.replace(QLatin1Char('/'), QLatin1Char('-'));
+
+        if (!m_paths.contains(id))
+            m_paths.insert(id, info.absoluteFilePath());
+    }
+}
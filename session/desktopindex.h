@@ -0,0 +1,47 @@
+#ifndef DESKTOPINDEX_H
+#define DESKTOPINDEX_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QHash>
+
+#include "desktopfile.h"
+
+class QFileSystemWatcher;
+
+/*! Maps desktop IDs to application entries in the XDG applications directories.
+    The directory scan is redone lazily after a watched directory changes,
+    parsed entries are reused as long as their file is unchanged.
+*/
+class DesktopIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DesktopIndex(QObject *parent = nullptr);
+
+    /// Looks up an entry by desktop ID, with or without the .desktop suffix.
+    DesktopFile find(const QString &desktopId);
+
+    /// Returns the desktop ID of the entry at path, or an empty string if it is not indexed.
+    QString desktopId(const QString &path);
+
+private slots:
+    void invalidate();
+
+private:
+    void rebuild();
+    void scan(const QString &root, const QString &dir);
+
+    struct CachedEntry {
+        QDateTime modified;
+        DesktopFile file;
+    };
+
+    QFileSystemWatcher *m_watcher;
+    QHash<QString, QString> m_paths;
+    QHash<QString, CachedEntry> m_entries;
+    bool m_dirty;
+};
+
+#endif // DESKTOPINDEX_H
@@ -0,0 +1,281 @@
+#include "displaysocket.h"
+
+#include <QRandomGenerator>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QtEndian>
+#include <QFile>
+#include <QDebug>
+
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const int maxDisplays = 32;
+static const QString x11SocketDir = QStringLiteral("/tmp/.X11-unix");
+
+// Abstract socket names start with a NUL byte and are not NUL terminated.
+static bool bindUnixSocket(int fd, const QByteArray &path, bool abstract = false)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    const size_t offset = abstract ? 1 : 0;
+    if (offset + size_t(path.size()) >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path + offset, path.constData(), size_t(path.size()));
+
+    const size_t length = offsetof(sockaddr_un, sun_path) + offset + size_t(path.size()) + (abstract ? 0 : 1);
+    return ::bind(fd, reinterpret_cast<sockaddr *>(&addr), socklen_t(length)) == 0
+            && ::listen(fd, 128) == 0;
+}
+
+static QString x11LockPath(int display)
+{
+    return QStringLiteral("/tmp/.X%1-lock").arg(display);
+}
+
+static QString x11SocketPath(int display)
+{
+    return x11SocketDir + QStringLiteral("/X%1").arg(display);
+}
+
+// Creates the X server lock file, replacing it if its owner is gone.
+static bool lockX11Display(int display)
+{
+    const QByteArray path = QFile::encodeName(x11LockPath(display));
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        const int fd = ::open(path.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+        if (fd >= 0) {
+            // Same format as the X server: the PID right aligned in ten columns.
+            const QByteArray pid = QByteArray::number(qint64(::getpid())).rightJustified(10, ' ') + '\n';
+            const bool written = ::write(fd, pid.constData(), size_t(pid.size())) == pid.size();
+            ::close(fd);
+            if (!written)
+                ::unlink(path.constData());
+            return written;
+        }
+
+        if (errno != EEXIST)
+            return false;
+
+        QFile lock(QFile::decodeName(path));
+        if (!lock.open(QIODevice::ReadOnly))
+            return false;
+        const pid_t owner = pid_t(lock.readAll().trimmed().toLongLong());
+        if (owner > 0 && (::kill(owner, 0) == 0 || errno != ESRCH))
+            return false;
+
+        ::unlink(path.constData());
+    }
+
+    return false;
+}
+
+WaylandSocket::WaylandSocket()
+    : m_fd(-1)
+    , m_lockFd(-1)
+{
+}
+
+WaylandSocket::~WaylandSocket()
+{
+    if (m_fd < 0)
+        return;
+
+    ::close(m_fd);
+    ::close(m_lockFd);
+    QFile::remove(m_path);
+    QFile::remove(m_path + QStringLiteral(".lock"));
+}
+
+bool WaylandSocket::create()
+{
+    const QString runtimeDir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (runtimeDir.isEmpty())
+        return false;
+
+    for (int display = 0; display < maxDisplays; ++display) {
+        const QString name = QStringLiteral("wayland-%1").arg(display);
+        const QString path = runtimeDir + QLatin1Char('/') + name;
+        const QByteArray lockPath = QFile::encodeName(path + QStringLiteral(".lock"));
+
+        const int lockFd = ::open(lockPath.constData(), O_CREAT | O_CLOEXEC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (lockFd < 0)
+            continue;
+
+        if (::flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+            // Held by another compositor.
+            ::close(lockFd);
+            continue;
+        }
+
+        // We own the lock, any socket file left behind is stale.
+        const QByteArray socketPath = QFile::encodeName(path);
+        ::unlink(socketPath.constData());
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || !bindUnixSocket(fd, socketPath)) {
+            qWarning() << "Could not bind Wayland socket" << path << strerror(errno);
+            if (fd >= 0)
+                ::close(fd);
+            ::close(lockFd);
+            return false;
+        }
+
+        m_name = name;
+        m_path = path;
+        m_fd = fd;
+        m_lockFd = lockFd;
+        qDebug() << "Listening for Wayland clients on" << path;
+        return true;
+    }
+
+    return false;
+}
+
+void WaylandSocket::adopt(const QString &name, int fd, int lockFd)
+{
+    if (fd < 0 || name.isEmpty())
+        return;
+
+    m_name = name;
+    m_path = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + QLatin1Char('/') + name;
+    m_fd = fd;
+    m_lockFd = lockFd;
+    ::fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+    ::fcntl(m_lockFd, F_SETFD, FD_CLOEXEC);
+}
+
+void WaylandSocket::prepareForReexec()
+{
+    if (m_fd < 0)
+        return;
+
+    ::fcntl(m_fd, F_SETFD, 0);
+    ::fcntl(m_lockFd, F_SETFD, 0);
+}
+
+X11DisplaySocket::X11DisplaySocket()
+    : m_display(-1)
+{
+}
+
+X11DisplaySocket::~X11DisplaySocket()
+{
+    if (m_fds.isEmpty())
+        return;
+
+    for (int fd : qAsConst(m_fds))
+        ::close(fd);
+    QFile::remove(x11SocketPath(m_display));
+    QFile::remove(x11LockPath(m_display));
+    QFile::remove(m_xauthority);
+}
+
+bool X11DisplaySocket::create()
+{
+    // The filesystem socket is optional, the abstract one is what clients on Linux try first.
+    ::mkdir(QFile::encodeName(x11SocketDir).constData(), 01777);
+
+    for (int display = 0; display < maxDisplays; ++display) {
+        if (!lockX11Display(display))
+            continue;
+
+        const QByteArray path = QFile::encodeName(x11SocketPath(display));
+        QList<int> fds;
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && bindUnixSocket(fd, path, true)) {
+            fds << fd;
+        } else if (fd >= 0) {
+            // Someone else owns the abstract name without a lock file.
+            ::close(fd);
+            QFile::remove(x11LockPath(display));
+            continue;
+        }
+
+        ::unlink(path.constData());
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && bindUnixSocket(fd, path))
+            fds << fd;
+        else if (fd >= 0)
+            ::close(fd);
+
+        if (fds.isEmpty()) {
+            QFile::remove(x11LockPath(display));
+            return false;
+        }
+
+        m_display = display;
+        m_fds = fds;
+
+        if (!writeXauthority())
+            qWarning() << "Could not write Xauthority file for display" << name();
+
+        qDebug() << "Reserved X11 display" << name();
+        return true;
+    }
+
+    return false;
+}
+
+bool X11DisplaySocket::writeXauthority()
+{
+    const QString runtimeDir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (runtimeDir.isEmpty())
+        return false;
+
+    // One FamilyWild entry, it matches the display regardless of the host name.
+    auto field = [](const QByteArray &data) {
+        quint16 length = qToBigEndian(quint16(data.size()));
+        return QByteArray(reinterpret_cast<const char *>(&length), sizeof(length)) + data;
+    };
+
+    QByteArray cookie(16, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(cookie.data()), cookie.size() / 4);
+
+    QByteArray entry;
+    entry += char(0xff);
+    entry += char(0xff);
+    entry += field(QByteArray());
+    entry += field(QByteArray::number(m_display));
+    entry += field(QByteArrayLiteral("MIT-MAGIC-COOKIE-1"));
+    entry += field(cookie);
+
+    QSaveFile file(runtimeDir + QStringLiteral("/prts-session-xauth-%1").arg(m_display));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+    file.write(entry);
+    if (!file.commit())
+        return false;
+
+    m_xauthority = file.fileName();
+    return true;
+}
+
+void X11DisplaySocket::adopt(int display, const QList<int> &fds, const QString &xauthority)
+{
+    if (display < 0 || fds.isEmpty())
+        return;
+
+    m_display = display;
+    m_fds = fds;
+    m_xauthority = xauthority;
+    for (int fd : qAsConst(m_fds))
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+void X11DisplaySocket::prepareForReexec()
+{
+    for (int fd : qAsConst(m_fds))
+        ::fcntl(fd, F_SETFD, 0);
+}
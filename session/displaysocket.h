@@ -0,0 +1,70 @@
+#ifndef DISPLAYSOCKET_H
+#define DISPLAYSOCKET_H
+
+#include <QString>
+#include <QList>
+
+/*! Listening socket for Wayland clients, created by the session and handed to the compositor.
+    Clients connecting before the compositor accepts simply wait in the listen backlog.
+*/
+class WaylandSocket
+{
+public:
+    WaylandSocket();
+    ~WaylandSocket();
+    Q_DISABLE_COPY(WaylandSocket)
+
+    /// Binds the first free wayland-N socket in $XDG_RUNTIME_DIR, following libwayland's locking.
+    bool create();
+    /// Takes over a socket created by a previous instance of the session.
+    void adopt(const QString &name, int fd, int lockFd);
+
+    bool isValid() const { return m_fd >= 0; }
+    QString name() const { return m_name; }
+    int fd() const { return m_fd; }
+    int lockFd() const { return m_lockFd; }
+
+    /// Keeps the descriptors open across exec().
+    void prepareForReexec();
+
+private:
+    QString m_name;
+    QString m_path;
+    int m_fd;
+    int m_lockFd;
+};
+
+/*! Listening sockets and lock file of an X11 display, handed to the compositor so it can
+    start Xwayland on the first X11 connection instead of at login.
+*/
+class X11DisplaySocket
+{
+public:
+    X11DisplaySocket();
+    ~X11DisplaySocket();
+    Q_DISABLE_COPY(X11DisplaySocket)
+
+    /// Locks the first free display number and binds its abstract and filesystem sockets.
+    bool create();
+    /// Takes over a display created by a previous instance of the session.
+    void adopt(int display, const QList<int> &fds, const QString &xauthority);
+
+    bool isValid() const { return !m_fds.isEmpty(); }
+    int display() const { return m_display; }
+    /// Returns the DISPLAY value, e.g. ":0".
+    QString name() const { return QStringLiteral(":%1").arg(m_display); }
+    QList<int> fds() const { return m_fds; }
+    /// Path of the Xauthority file holding the cookie for this display.
+    QString xauthority() const { return m_xauthority; }
+
+    void prepareForReexec();
+
+private:
+    bool writeXauthority();
+
+    int m_display;
+    QList<int> m_fds;
+    QString m_xauthority;
+};
+
+#endif // DISPLAYSOCKET_H
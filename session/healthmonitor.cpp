@@ -0,0 +1,197 @@
+#include "healthmonitor.h"
+#include "sessionmetrics.h"
+#include "timerwheel.h"
+
+#include <QDBusPendingCallWatcher>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QFile>
+#include <QDebug>
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+HealthMonitor::HealthMonitor(QObject *parent)
+    : QObject(parent)
+    , m_wheel(new TimerWheel(250, 256, this))
+    , m_nextAttempt(1)
+{
+}
+
+HealthMonitor::~HealthMonitor()
+{
+    for (Probe &probe : m_probes)
+        reset(probe);
+}
+
+void HealthMonitor::watch(const SessionComponent &component)
+{
+    if (component.probe.isEmpty())
+        return;
+
+    unwatch(component.name);
+
+    const QByteArray label = SessionMetrics::label("component", component.name);
+    Probe probe;
+    probe.component = component;
+    probe.latency = SessionMetrics::self()->histogram("prts_session_probe_latency_seconds",
+                                                      "Round trip time of successful liveness probes.", label);
+    probe.failed = SessionMetrics::self()->counter("prts_session_probe_failures_total",
+                                                   "Liveness probes that failed or timed out.", label);
+    m_probes.insert(component.name, probe);
+
+    // The first probe waits one interval, the component is still starting up.
+    schedule(component.name);
+}
+
+void HealthMonitor::unwatch(const QString &name)
+{
+    auto it = m_probes.find(name);
+    if (it == m_probes.end())
+        return;
+
+    reset(*it);
+    m_probes.erase(it);
+}
+
+void HealthMonitor::reset(Probe &probe)
+{
+    m_wheel->cancel(probe.timer);
+    probe.timer = 0;
+    probe.attempt = 0;
+
+    delete probe.notifier;
+    probe.notifier = nullptr;
+    if (probe.socket >= 0)
+        ::close(probe.socket);
+    probe.socket = -1;
+}
+
+void HealthMonitor::schedule(const QString &name)
+{
+    Probe &probe = m_probes[name];
+    probe.timer = m_wheel->schedule(probe.component.probeInterval, [this, name] { run(name); });
+}
+
+void HealthMonitor::run(const QString &name)
+{
+    auto it = m_probes.find(name);
+    if (it == m_probes.end())
+        return;
+
+    Probe &probe = *it;
+    const quint64 attempt = m_nextAttempt++;
+    probe.attempt = attempt;
+    probe.elapsed.start();
+    probe.timer = m_wheel->schedule(probe.component.probeTimeout, [this, name, attempt] {
+        finish(name, attempt, false);
+    });
+
+    const QString target = probe.component.probe.section(QLatin1Char(':'), 1);
+    if (probe.component.probe.startsWith(QLatin1String("dbus:")))
+        probeDBus(probe, target);
+    else
+        probeSocket(probe, target);
+}
+
+void HealthMonitor::probeDBus(Probe &probe, const QString &target)
+{
+    const QString name = probe.component.name;
+    const quint64 attempt = probe.attempt;
+
+    // Peer.Ping is answered by libdbus or GDBus on their own threads even with a hung main loop,
+    // Introspect of an exported object is dispatched to the thread that owns it.
+    const int slash = target.indexOf(QLatin1Char('/'));
+    QDBusMessage ping = QDBusMessage::createMethodCall(target.left(slash), target.mid(slash),
+                                                       QStringLiteral("org.freedesktop.DBus.Introspectable"),
+                                                       QStringLiteral("Introspect"));
+    QDBusPendingCallWatcher *watcher =
+            new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(ping, probe.component.probeTimeout), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, watcher, name, attempt] {
+        finish(name, attempt, !watcher->isError());
+        watcher->deleteLater();
+    });
+}
+
+void HealthMonitor::probeSocket(Probe &probe, const QString &path)
+{
+    const QString name = probe.component.name;
+    const quint64 attempt = probe.attempt;
+
+    QString socketPath = path;
+    if (!socketPath.startsWith(QLatin1Char('/')))
+        socketPath = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + QLatin1Char('/') + path;
+    const QByteArray encoded = QFile::encodeName(socketPath);
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (size_t(encoded.size()) >= sizeof(addr.sun_path)) {
+        finish(name, attempt, false);
+        return;
+    }
+    memcpy(addr.sun_path, encoded.constData(), size_t(encoded.size()));
+
+    // A connection only proves the kernel accepted it, the reply proves the event loop runs.
+    probe.socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe.socket < 0
+            || ::connect(probe.socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+            || ::send(probe.socket, "ping\n", 5, MSG_NOSIGNAL) != 5) {
+        finish(name, attempt, false);
+        return;
+    }
+
+    probe.notifier = new QSocketNotifier(probe.socket, QSocketNotifier::Read, this);
+    connect(probe.notifier, &QSocketNotifier::activated, this, [this, name, attempt](QSocketDescriptor socket) {
+        char buffer[64];
+        const ssize_t size = ::recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        finish(name, attempt, size > 0);
+    });
+}
+
+void HealthMonitor::finish(const QString &name, quint64 attempt, bool ok)
+{
+    auto it = m_probes.find(name);
+    if (it == m_probes.end() || it->attempt != attempt)
+        return;
+
+    Probe &probe = *it;
+    const qint64 latency = probe.elapsed.nsecsElapsed();
+
+    // Replies and timeouts race, the first one wins and resets the probe.
+    if (probe.notifier) {
+        probe.notifier->setEnabled(false);
+        probe.notifier->deleteLater();
+        probe.notifier = nullptr;
+    }
+    if (probe.socket >= 0)
+        ::close(probe.socket);
+    probe.socket = -1;
+    m_wheel->cancel(probe.timer);
+    probe.timer = 0;
+    probe.attempt = 0;
+
+    if (ok) {
+        probe.latency->observe(latency);
+        probe.failures = 0;
+        schedule(name);
+        return;
+    }
+
+    probe.failed->increment();
+    ++probe.failures;
+    qWarning() << "Liveness probe failed for" << name << probe.failures << "of" << probe.component.probeFailures;
+
+    if (probe.failures < probe.component.probeFailures) {
+        schedule(name);
+        return;
+    }
+
+    unwatch(name);
+    emit unresponsive(name);
+}
@@ -0,0 +1,59 @@
+#ifndef HEALTHMONITOR_H
+#define HEALTHMONITOR_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include "sessionmanifest.h"
+
+class QSocketNotifier;
+class MetricCounter;
+class MetricHistogram;
+class TimerWheel;
+
+/*! Runs the liveness probes declared in the session manifest.
+    All probes share one timer wheel, an idle probe costs no timer and no file descriptor.
+*/
+class HealthMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HealthMonitor(QObject *parent = nullptr);
+    ~HealthMonitor() override;
+
+    /// Starts probing a running component, does nothing if it declares no probe.
+    void watch(const SessionComponent &component);
+    void unwatch(const QString &name);
+
+signals:
+    /// The component failed its probe probeFailures times in a row, it is no longer probed.
+    void unresponsive(const QString &name);
+
+private:
+    struct Probe {
+        SessionComponent component;
+        quint64 attempt = 0;
+        quint64 timer = 0;
+        int failures = 0;
+        QElapsedTimer elapsed;
+        int socket = -1;
+        QSocketNotifier *notifier = nullptr;
+        MetricHistogram *latency = nullptr;
+        MetricCounter *failed = nullptr;
+    };
+
+    void schedule(const QString &name);
+    void run(const QString &name);
+    void probeDBus(Probe &probe, const QString &target);
+    void probeSocket(Probe &probe, const QString &path);
+    void finish(const QString &name, quint64 attempt, bool ok);
+    void reset(Probe &probe);
+
+    QHash<QString, Probe> m_probes;
+    TimerWheel *m_wheel;
+    quint64 m_nextAttempt;
+};
+
+#endif // HEALTHMONITOR_H
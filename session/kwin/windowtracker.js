@@ -0,0 +1,14 @@
+// Loaded into kwin_wayland by prts-session to measure time to first window.
+// Reports every new toplevel window with the PID of its client and its desktop file name.
+
+function report(window) {
+    if (!window.normalWindow && !window.dialog)
+        return;
+
+    // PIDs are sent as strings, script numbers arrive as doubles on the bus.
+    callDBus("org.cutefish.Session", "/Session", "org.prts.Session", "WindowShown",
+             String(window.pid), window.desktopFileName || "");
+}
+
+workspace.windowAdded.connect(report);
+workspace.windowList().forEach(report);
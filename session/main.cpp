@@ -1,5 +1,8 @@
 #include "application.h"
-#include <QQuickWindow>
+#include "sessionmetrics.h"
+
+#include <QTimer>
+#include <QDebug>
 
 int main(int argc, char *argv[])
 {
@@ -9,13 +12,10 @@ int main(int argc, char *argv[])
     // 设置QT_QPA_PLATFORM为wayland
     qputenv("QT_QPA_PLATFORM", QByteArrayLiteral("wayland"));
 
-    QQuickWindow::setDefaultAlphaBuffer(true);
-    QCoreApplication::setAttribute(Qt::AA_DisableHighDpiScaling);
-
     Application a(argc, argv);
-    a.setQuitOnLastWindowClosed(false);
 
     qDebug() << "Starting session application";
+    QTimer::singleShot(0, &a, [] { SessionMetrics::self()->recordStartup(); });
 
     return a.exec();
 }
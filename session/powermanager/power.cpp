@@ -22,16 +22,36 @@
 
 #include "power.h"
 #include "powerproviders.h"
+#include "../sessionmetrics.h"
 
+#include <QElapsedTimer>
+#include <QSettings>
 #include <QtAlgorithms>
 #include <QDebug>
 
+static MetricHistogram *providerLatency(const PowerProvider *provider, const char *call)
+{
+    return SessionMetrics::self()->histogram("prts_session_power_dbus_latency_seconds",
+                                             "Duration of power provider D-Bus calls.",
+                                             SessionMetrics::label("provider", provider->name()) + ','
+                                             + SessionMetrics::label("call", QLatin1String(call)));
+}
+
 Power::Power(bool useSessionProvider, QObject * parent /*= nullptr*/) :
-    QObject(parent)
+    QObject(parent),
+    m_upower(new UPowerProvider(this))
 {
     m_providers.append(new SystemdProvider(this));
-    m_providers.append(new UPowerProvider(this));
+    m_providers.append(m_upower);
     m_providers.append(new ConsoleKitProvider(this));
+
+    connect(m_upower, &UPowerProvider::onBatteryChanged, this, &Power::onBatteryChanged);
+
+    // [Power] upowerTimeout=, consolekitTimeout= and systemdTimeout= in milliseconds.
+    QSettings settings(QSettings::UserScope, "PRTS", "session");
+    settings.beginGroup("Power");
+    for (PowerProvider *provider : qAsConst(m_providers))
+        provider->setCallTimeout(settings.value(provider->name() + "Timeout", provider->callTimeout()).toInt());
 }
 
 Power::Power(QObject * parent /*= nullptr*/)
@@ -39,15 +59,46 @@ Power::Power(QObject * parent /*= nullptr*/)
 {
 }
 
+Power::Power(const QList<PowerProvider*> &providers, QObject * parent /*= nullptr*/) :
+    QObject(parent),
+    m_providers(providers),
+    m_upower(nullptr)
+{
+    for (PowerProvider *provider : providers)
+        provider->setParent(this);
+}
+
 Power::~Power()
 {
 }
 
+bool Power::onBattery() const
+{
+    return m_upower && m_upower->onBattery();
+}
+
+QVariantMap Power::providerHealth() const
+{
+    QVariantMap result;
+    for (const PowerProvider *provider : qAsConst(m_providers))
+        result.insert(provider->name(), provider->health());
+    return result;
+}
+
 bool Power::canAction(Power::Action action) const
 {
-    for(const PowerProvider* provider : qAsConst(m_providers))
-        if (provider->canAction(action))
+    for(PowerProvider* provider : qAsConst(m_providers)) {
+        if (!provider->isHealthy())
+            continue;
+
+        QElapsedTimer timer;
+        timer.start();
+        const bool can = provider->canAction(action);
+        providerLatency(provider, "can")->observe(timer);
+
+        if (can)
             return true;
+    }
 
     return false;
 }
@@ -55,10 +106,23 @@ bool Power::canAction(Power::Action action) const
 bool Power::doAction(Power::Action action)
 {
     for(PowerProvider* provider : qAsConst(m_providers)) {
-        if (provider->canAction(action) &&
-            provider->doAction(action)) {
+        if (!provider->isHealthy())
+            continue;
+
+        QElapsedTimer timer;
+        timer.start();
+        const bool can = provider->canAction(action);
+        providerLatency(provider, "can")->observe(timer);
+
+        if (!can)
+            continue;
+
+        timer.restart();
+        const bool done = provider->doAction(action);
+        providerLatency(provider, "do")->observe(timer);
+
+        if (done)
             return true;
-        }
     }
     return false;
 }
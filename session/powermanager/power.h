@@ -25,8 +25,10 @@
 
 #include <QObject>
 #include <QList>
+#include <QVariantMap>
 
 class PowerProvider;
+class UPowerProvider;
 
 /*! Power class provides an interface to control system-wide power and session management.
     It allows logout from the user session, hibernate, reboot, shutdown and suspend computer.
@@ -58,6 +60,8 @@ public:
     explicit Power(bool useSessionProvider, QObject *parent = nullptr);
     /// Constructs a Power with using the lxqt-session provider.
     explicit Power(QObject *parent = nullptr);
+    /// Constructs a Power that asks the given providers in order, and takes ownership of them.
+    explicit Power(const QList<PowerProvider*> &providers, QObject *parent = nullptr);
 
     /// Destroys the object.
     ~Power() override;
@@ -86,6 +90,16 @@ public:
     //! This function is provided for convenience. It's equivalent to calling canAction(PowerShowLeaveDialog).
     bool canShowLeaveDialog() const;
 
+    /// Returns true if the system runs on battery, as reported by UPower.
+    bool onBattery() const;
+
+    /*! Returns the health of every provider by name, see PowerProvider::health().
+        Providers that keep timing out are skipped until they answer again. */
+    QVariantMap providerHealth() const;
+
+Q_SIGNALS:
+    void onBatteryChanged(bool onBattery);
+
 public Q_SLOTS:
     /// Performs the requested action.
     bool doAction(Action action);
@@ -113,6 +127,7 @@ public Q_SLOTS:
 
 private:
     QList<PowerProvider*> m_providers;
+    UPowerProvider *m_upower;
 };
 
 #endif
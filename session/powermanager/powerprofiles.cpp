@@ -0,0 +1,99 @@
+#include "powerprofiles.h"
+
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusMessage>
+#include <QTimer>
+#include <QDebug>
+
+#define POWER_PROFILES_SERVICE      "net.hadess.PowerProfiles"
+#define POWER_PROFILES_PATH         "/net/hadess/PowerProfiles"
+#define POWER_PROFILES_INTERFACE    POWER_PROFILES_SERVICE
+
+PowerProfileHold::PowerProfileHold(QObject *parent)
+    : PowerProfileHold(QDBusConnection::systemBus(),
+                       QStringLiteral(POWER_PROFILES_SERVICE),
+                       QStringLiteral(POWER_PROFILES_PATH),
+                       QStringLiteral(POWER_PROFILES_INTERFACE),
+                       parent)
+{
+}
+
+PowerProfileHold::PowerProfileHold(const QDBusConnection &connection, const QString &service,
+                                   const QString &path, const QString &interface, QObject *parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_service(service)
+    , m_path(path)
+    , m_interface(interface)
+    , m_timeout(new QTimer(this))
+    , m_cookie(0)
+    , m_held(false)
+    , m_pending(false)
+{
+    m_timeout->setSingleShot(true);
+    connect(m_timeout, &QTimer::timeout, this, &PowerProfileHold::release);
+}
+
+PowerProfileHold::~PowerProfileHold()
+{
+    release();
+}
+
+void PowerProfileHold::hold(const QString &profile, const QString &reason, int timeout)
+{
+    if (m_held || m_pending)
+        return;
+
+    QDBusMessage msg = QDBusMessage::createMethodCall(m_service, m_path, m_interface, QStringLiteral("HoldProfile"));
+    msg << profile << reason << QStringLiteral("prts-session");
+
+    // Asynchronous, the daemon must not delay the session startup it is meant to speed up.
+    m_pending = true;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_connection.asyncCall(msg), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, watcher, profile] {
+        watcher->deleteLater();
+        QDBusPendingReply<quint32> reply = *watcher;
+
+        const bool cancelled = !m_pending;
+        m_pending = false;
+
+        if (reply.isError()) {
+            qDebug() << "Could not hold power profile" << profile << reply.error().message();
+            return;
+        }
+
+        m_cookie = reply.value();
+        m_held = true;
+        qDebug() << "Holding power profile" << profile;
+        emit held(profile);
+
+        if (cancelled)
+            release();
+    });
+
+    m_timeout->start(timeout);
+}
+
+void PowerProfileHold::release()
+{
+    m_timeout->stop();
+
+    if (m_pending) {
+        // The hold is released as soon as its reply arrives.
+        m_pending = false;
+        return;
+    }
+
+    if (!m_held)
+        return;
+
+    QDBusMessage msg = QDBusMessage::createMethodCall(m_service, m_path, m_interface, QStringLiteral("ReleaseProfile"));
+    msg << m_cookie;
+    m_connection.send(msg);
+
+    m_held = false;
+    m_cookie = 0;
+    qDebug() << "Released power profile hold";
+    emit released();
+}
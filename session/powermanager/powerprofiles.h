@@ -0,0 +1,44 @@
+#ifndef POWERPROFILES_H
+#define POWERPROFILES_H
+
+#include <QObject>
+#include <QDBusConnection>
+
+class QTimer;
+
+/*! Holds a power-profiles-daemon profile for a limited time.
+    The daemon drops the hold by itself if the session goes away, restoring the previous profile.
+    The connection and service can be replaced to run against a mock daemon.
+*/
+class PowerProfileHold : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PowerProfileHold(QObject *parent = nullptr);
+    PowerProfileHold(const QDBusConnection &connection, const QString &service,
+                     const QString &path, const QString &interface, QObject *parent = nullptr);
+    ~PowerProfileHold() override;
+
+    /// Asks for profile until release() is called or timeout ms have passed.
+    void hold(const QString &profile, const QString &reason, int timeout);
+    void release();
+
+    bool isHeld() const { return m_held; }
+
+signals:
+    void held(const QString &profile);
+    void released();
+
+private:
+    QDBusConnection m_connection;
+    QString m_service;
+    QString m_path;
+    QString m_interface;
+    QTimer *m_timeout;
+    quint32 m_cookie;
+    bool m_held;
+    bool m_pending;
+};
+
+#endif // POWERPROFILES_H
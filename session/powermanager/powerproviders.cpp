@@ -22,7 +22,13 @@
 
 
 #include "powerproviders.h"
-#include <QDBusInterface>
+#include "../sessionmetrics.h"
+#include <QDBusPendingCallWatcher>
+#include <QDBusReply>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFile>
+#include <QDir>
 #include <QProcess>
 #include <QDebug>
 #include <signal.h> // for kill()
@@ -41,6 +47,13 @@
 
 #define PROPERTIES_INTERFACE    "org.freedesktop.DBus.Properties"
 
+// Deadline of a single provider call, logind gets longer since it may ask polkit.
+static const int defaultCallTimeout = 2000;
+static const int systemdCallTimeout = 5000;
+// Consecutive timeouts that open the circuit, and how often it is probed while open.
+static const int failureThreshold = 3;
+static const int probeInterval = 30 * 1000;
+
 /************************************************
  Helper func
  ************************************************/
@@ -52,10 +65,28 @@ void printDBusMsg(const QDBusMessage &msg)
     qWarning() << "****************************************";
 }
 
+/************************************************
+ Helper func
+
+ Calls with the provider's deadline and records
+ the outcome for its circuit breaker.
+ ************************************************/
+static QDBusMessage providerCall(PowerProvider *provider,
+                                 const QDBusConnection &connection,
+                                 const QDBusMessage &call)
+{
+    QElapsedTimer timer;
+    timer.start();
+    const QDBusMessage reply = connection.call(call, QDBus::Block, provider->callTimeout());
+    provider->recordCall(reply, timer.elapsed());
+    return reply;
+}
+
 /************************************************
  Helper func
  ************************************************/
-static bool dbusCall(const QString &service,
+static bool dbusCall(PowerProvider *provider,
+              const QString &service,
               const QString &path,
               const QString &interface,
               const QDBusConnection &connection,
@@ -63,22 +94,9 @@ static bool dbusCall(const QString &service,
               PowerProvider::DbusErrorCheck errorCheck = PowerProvider::CheckDBUS
               )
 {
-    QDBusInterface dbus(service, path, interface, connection);
-    
-    if (!dbus.isValid()) {
-        qWarning() << "dbusCall: QDBusInterface is invalid" << service << path << interface << method;
-        if (errorCheck == PowerProvider::CheckDBUS)
-        {
-            // Notification::notify(
-            //                         QObject::tr("Power Manager Error"),
-            //                         QObject::tr("QDBusInterface is invalid") + QStringLiteral("\n\n") + service + QStringLiteral(' ') + path + QStringLiteral(' ') + interface + QStringLiteral(' ') + method,
-            //                         QStringLiteral("logo.png"));
-        }
-        return false;
-    }
-
-    QDBusMessage msg = dbus.call(method);
-    if (!msg.errorName().isEmpty()) {
+    const QDBusMessage msg = providerCall(provider, connection,
+                                          QDBusMessage::createMethodCall(service, path, interface, method));
+    if (msg.type() == QDBusMessage::ErrorMessage) {
         printDBusMsg(msg);
         if (errorCheck == PowerProvider::CheckDBUS)
         {
@@ -87,6 +105,7 @@ static bool dbusCall(const QString &service,
             //                         msg.errorName() + QStringLiteral("\n\n") + msg.errorMessage(),
             //                         QStringLiteral("logo.png"));
         }
+        return false;
     }
 
     // If the method no returns value, we believe that it was successful.
@@ -102,7 +121,8 @@ static bool dbusCall(const QString &service,
  returns a string instead of a bool, and it takes
  an "interactivity boolean" as an argument.
  ************************************************/
-static bool dbusCallSystemd(const QString &service,
+static bool dbusCallSystemd(PowerProvider *provider,
+                     const QString &service,
                      const QString &path,
                      const QString &interface,
                      const QDBusConnection &connection,
@@ -111,22 +131,12 @@ static bool dbusCallSystemd(const QString &service,
                      PowerProvider::DbusErrorCheck errorCheck = PowerProvider::CheckDBUS
                      )
 {
-    QDBusInterface dbus(service, path, interface, connection);
-    if (!dbus.isValid()) {
-        qWarning() << "dbusCall: QDBusInterface is invalid" << service << path << interface << method;
-        if (errorCheck == PowerProvider::CheckDBUS) {
-            // Notification::notify(
-            //                         QObject::tr("Power Manager Error"),
-            //                         QObject::tr("QDBusInterface is invalid") + QStringLiteral("\n\n") + service + QStringLiteral(' ') + path + QStringLiteral(' ')+ interface + QStringLiteral(' ') + method,
-            //                         QStringLiteral("logo.png"));
-        }
-
-        return false;
-    }
-
-    QDBusMessage msg = dbus.call(method, needBoolArg ? QVariant(true) : QVariant());
+    QDBusMessage call = QDBusMessage::createMethodCall(service, path, interface, method);
+    if (needBoolArg)
+        call << true;
 
-    if (!msg.errorName().isEmpty()) {
+    const QDBusMessage msg = providerCall(provider, connection, call);
+    if (msg.type() == QDBusMessage::ErrorMessage) {
         printDBusMsg(msg);
         if (errorCheck == PowerProvider::CheckDBUS) {
             // Notification::notify(
@@ -134,6 +144,7 @@ static bool dbusCallSystemd(const QString &service,
             //                         msg.errorName() + QStringLiteral("\n\n") + msg.errorMessage(),
             //                         QStringLiteral("logo.png"));
         }
+        return false;
     }
 
     // If the method no returns value, we believe that it was successful.
@@ -148,34 +159,26 @@ static bool dbusCallSystemd(const QString &service,
 /************************************************
  Helper func
  ************************************************/
-bool dbusGetProperty(const QString &service,
+static bool dbusGetProperty(PowerProvider *provider,
+                     const QString &service,
                      const QString &path,
                      const QString &interface,
                      const QDBusConnection &connection,
                      const QString & property
                     )
 {
-    QDBusInterface dbus(service, path, interface, connection);
-    if (!dbus.isValid())
-    {
-        qWarning() << "dbusGetProperty: QDBusInterface is invalid" << service << path << interface << property;
-//        Notification::notify(QObject::tr("Power Manager"),
-//                                  "logo.png",
-//                                  QObject::tr("Power Manager Error"),
-//                                  QObject::tr("QDBusInterface is invalid")+ "\n\n" + service +" " + path +" " + interface +" " + property);
-
-        return false;
-    }
-
-    QDBusMessage msg = dbus.call(QStringLiteral("Get"), dbus.interface(), property);
+    QDBusMessage call = QDBusMessage::createMethodCall(service, path, interface, QStringLiteral("Get"));
+    call << interface << property;
 
-    if (!msg.errorName().isEmpty())
+    const QDBusMessage msg = providerCall(provider, connection, call);
+    if (msg.type() == QDBusMessage::ErrorMessage)
     {
         printDBusMsg(msg);
 //        Notification::notify(QObject::tr("Power Manager"),
 //                                  "logo.png",
 //                                  QObject::tr("Power Manager Error (Get Property)"),
 //                                  msg.errorName() + "\n\n" + msg.errorMessage());
+        return false;
     }
 
     return !msg.arguments().isEmpty() &&
@@ -186,27 +189,130 @@ bool dbusGetProperty(const QString &service,
  PowerProvider
  ************************************************/
 PowerProvider::PowerProvider(QObject *parent):
-    QObject(parent)
+    QObject(parent),
+    m_callTimeout(defaultCallTimeout),
+    m_healthy(true),
+    m_timeouts(0),
+    m_lastLatency(-1),
+    m_probeTimer(new QTimer(this))
 {
+    m_probeTimer->setInterval(probeInterval);
+    connect(m_probeTimer, &QTimer::timeout, this, &PowerProvider::probe);
 }
 
 PowerProvider::~PowerProvider()
 {
 }
 
+QVariantMap PowerProvider::health() const
+{
+    return QVariantMap {
+        { QStringLiteral("healthy"), m_healthy },
+        { QStringLiteral("timeouts"), m_timeouts },
+        { QStringLiteral("callTimeout"), m_callTimeout },
+        { QStringLiteral("lastLatency"), m_lastLatency },
+    };
+}
+
+void PowerProvider::recordCall(const QDBusMessage &reply, qint64 latencyMsecs)
+{
+    m_lastLatency = latencyMsecs;
+
+    const QString error = reply.errorName();
+    if (error != QLatin1String("org.freedesktop.DBus.Error.NoReply")
+            && error != QLatin1String("org.freedesktop.DBus.Error.Timeout")) {
+        m_timeouts = 0;
+        return;
+    }
+
+    SessionMetrics::self()->counter("prts_session_power_dbus_timeouts_total",
+                                    "Power provider D-Bus calls that ran into their deadline.",
+                                    SessionMetrics::label("provider", name()))->increment();
+
+    if (++m_timeouts >= failureThreshold && m_healthy) {
+        qWarning() << "Power provider" << name() << "timed out" << m_timeouts << "times, skipping it";
+        setHealthy(false);
+    }
+}
+
+void PowerProvider::setHealthy(bool healthy)
+{
+    m_healthy = healthy;
+    SessionMetrics::self()->gauge("prts_session_power_provider_healthy",
+                                  "Whether a power provider is used, 0 while its circuit is open.",
+                                  SessionMetrics::label("provider", name()))->set(healthy ? 1 : 0);
+
+    if (healthy)
+        m_probeTimer->stop();
+    else if (!service().isEmpty())
+        m_probeTimer->start();
+
+    emit healthChanged(healthy);
+}
+
+void PowerProvider::probe()
+{
+    // Peer.Ping is answered by the service's D-Bus library, but only if it still dispatches.
+    const QDBusMessage ping = QDBusMessage::createMethodCall(service(),
+                                                             QStringLiteral("/"),
+                                                             QStringLiteral("org.freedesktop.DBus.Peer"),
+                                                             QStringLiteral("Ping"));
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(QDBusConnection::systemBus().asyncCall(ping, m_callTimeout), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, watcher] {
+        if (!watcher->isError() && !m_healthy) {
+            qDebug() << "Power provider" << name() << "answers again";
+            m_timeouts = 0;
+            setHealthy(true);
+        }
+        watcher->deleteLater();
+    });
+}
+
 /************************************************
  UPowerProvider
  ************************************************/
+static bool sysfsOnBattery()
+{
+    // On battery when a battery is present and no mains supply is online.
+    const QDir supplies(QStringLiteral("/sys/class/power_supply"));
+    bool battery = false;
+
+    const QStringList entries = supplies.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &entry : entries) {
+        QFile type(supplies.absoluteFilePath(entry + QStringLiteral("/type")));
+        QFile online(supplies.absoluteFilePath(entry + QStringLiteral("/online")));
+        if (!type.open(QIODevice::ReadOnly))
+            continue;
+
+        const QByteArray kind = type.readAll().trimmed();
+        if (kind == "Battery")
+            battery = true;
+        else if (kind == "Mains" && online.open(QIODevice::ReadOnly) && online.readAll().trimmed() == "1")
+            return false;
+    }
+
+    return battery;
+}
+
 UPowerProvider::UPowerProvider(QObject *parent):
-    PowerProvider(parent)
+    PowerProvider(parent),
+    m_onBattery(sysfsOnBattery())
 {
+    QDBusConnection::systemBus().connect(QStringLiteral(UPOWER_SERVICE),
+                                         QStringLiteral(UPOWER_PATH),
+                                         QStringLiteral(PROPERTIES_INTERFACE),
+                                         QStringLiteral("PropertiesChanged"),
+                                         this,
+                                         SLOT(propertiesChanged(QString,QVariantMap,QStringList)));
+    queryOnBattery();
 }
 
 UPowerProvider::~UPowerProvider()
 {
 }
 
-bool UPowerProvider::canAction(Power::Action action) const
+bool UPowerProvider::canAction(Power::Action action)
 {
     QString command;
     QString property;
@@ -224,6 +330,7 @@ bool UPowerProvider::canAction(Power::Action action) const
     }
 
     return dbusGetProperty(  // Whether the system is able to hibernate.
+                this,
                 QStringLiteral(UPOWER_SERVICE),
                 QStringLiteral(UPOWER_PATH),
                 QStringLiteral(PROPERTIES_INTERFACE),
@@ -232,6 +339,7 @@ bool UPowerProvider::canAction(Power::Action action) const
             )
             &&
             dbusCall( // Check if the caller has (or can get) the PolicyKit privilege to call command.
+                this,
                 QStringLiteral(UPOWER_SERVICE),
                 QStringLiteral(UPOWER_PATH),
                 QStringLiteral(UPOWER_INTERFACE),
@@ -260,13 +368,56 @@ bool UPowerProvider::doAction(Power::Action action)
     }
 
 
-    return dbusCall(QStringLiteral(UPOWER_SERVICE),
+    return dbusCall(this,
+             QStringLiteral(UPOWER_SERVICE),
              QStringLiteral(UPOWER_PATH),
              QStringLiteral(UPOWER_INTERFACE),
              QDBusConnection::systemBus(),
              command );
 }
 
+QString UPowerProvider::service() const
+{
+    return QStringLiteral(UPOWER_SERVICE);
+}
+
+void UPowerProvider::queryOnBattery()
+{
+    QDBusMessage get = QDBusMessage::createMethodCall(QStringLiteral(UPOWER_SERVICE),
+                                                      QStringLiteral(UPOWER_PATH),
+                                                      QStringLiteral(PROPERTIES_INTERFACE),
+                                                      QStringLiteral("Get"));
+    get << QStringLiteral(UPOWER_INTERFACE) << QStringLiteral("OnBattery");
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(QDBusConnection::systemBus().asyncCall(get), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, watcher] {
+        const QDBusReply<QDBusVariant> reply = *watcher;
+        if (reply.isValid())
+            setOnBattery(reply.value().variant().toBool());
+        watcher->deleteLater();
+    });
+}
+
+void UPowerProvider::propertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &invalidated)
+{
+    if (interface != QLatin1String(UPOWER_INTERFACE))
+        return;
+
+    if (changed.contains(QStringLiteral("OnBattery")))
+        setOnBattery(changed.value(QStringLiteral("OnBattery")).toBool());
+    else if (invalidated.contains(QStringLiteral("OnBattery")))
+        queryOnBattery();
+}
+
+void UPowerProvider::setOnBattery(bool onBattery)
+{
+    if (m_onBattery == onBattery)
+        return;
+
+    m_onBattery = onBattery;
+    emit onBatteryChanged(onBattery);
+}
+
 /************************************************
  ConsoleKitProvider
  ************************************************/
@@ -279,7 +430,12 @@ ConsoleKitProvider::~ConsoleKitProvider()
 {
 }
 
-bool ConsoleKitProvider::canAction(Power::Action action) const
+QString ConsoleKitProvider::service() const
+{
+    return QStringLiteral(CONSOLEKIT_SERVICE);
+}
+
+bool ConsoleKitProvider::canAction(Power::Action action)
 {
     QString command;
     switch (action) {
@@ -303,7 +459,8 @@ bool ConsoleKitProvider::canAction(Power::Action action) const
         return false;
     }
 
-    return dbusCallSystemd(QStringLiteral(CONSOLEKIT_SERVICE),
+    return dbusCallSystemd(this,
+                    QStringLiteral(CONSOLEKIT_SERVICE),
                     QStringLiteral(CONSOLEKIT_PATH),
                     QStringLiteral(CONSOLEKIT_INTERFACE),
                     QDBusConnection::systemBus(),
@@ -336,7 +493,8 @@ bool ConsoleKitProvider::doAction(Power::Action action)
         return false;
     }
 
-    return dbusCallSystemd(QStringLiteral(CONSOLEKIT_SERVICE),
+    return dbusCallSystemd(this,
+                    QStringLiteral(CONSOLEKIT_SERVICE),
                 QStringLiteral(CONSOLEKIT_PATH),
                 QStringLiteral(CONSOLEKIT_INTERFACE),
                 QDBusConnection::systemBus(),
@@ -353,13 +511,19 @@ bool ConsoleKitProvider::doAction(Power::Action action)
 SystemdProvider::SystemdProvider(QObject *parent):
     PowerProvider(parent)
 {
+    setCallTimeout(systemdCallTimeout);
 }
 
 SystemdProvider::~SystemdProvider()
 {
 }
 
-bool SystemdProvider::canAction(Power::Action action) const
+QString SystemdProvider::service() const
+{
+    return QStringLiteral(SYSTEMD_SERVICE);
+}
+
+bool SystemdProvider::canAction(Power::Action action)
 {
     QString command;
 
@@ -380,7 +544,8 @@ bool SystemdProvider::canAction(Power::Action action) const
         return false;
     }
 
-    return dbusCallSystemd(QStringLiteral(SYSTEMD_SERVICE),
+    return dbusCallSystemd(this,
+                    QStringLiteral(SYSTEMD_SERVICE),
                     QStringLiteral(SYSTEMD_PATH),
                     QStringLiteral(SYSTEMD_INTERFACE),
                     QDBusConnection::systemBus(),
@@ -414,7 +579,8 @@ bool SystemdProvider::doAction(Power::Action action)
         return false;
     }
 
-    return dbusCallSystemd(QStringLiteral(SYSTEMD_SERVICE),
+    return dbusCallSystemd(this,
+                    QStringLiteral(SYSTEMD_SERVICE),
              QStringLiteral(SYSTEMD_PATH),
              QStringLiteral(SYSTEMD_INTERFACE),
              QDBusConnection::systemBus(),
@@ -435,7 +601,7 @@ HalProvider::~HalProvider()
 {
 }
 
-bool HalProvider::canAction(Power::Action action) const
+bool HalProvider::canAction(Power::Action action)
 {
     Q_UNUSED(action)
     return false;
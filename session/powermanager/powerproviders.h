@@ -27,6 +27,10 @@
 
 #include <QObject>
 #include <QProcess> // for PID_T
+#include <QVariantMap>
+
+class QDBusMessage;
+class QTimer;
 
 class PowerProvider: public QObject
 {
@@ -41,14 +45,50 @@ public:
     explicit PowerProvider(QObject *parent = nullptr);
     ~PowerProvider() override;
 
+    /*! Deadline in milliseconds for a single D-Bus call of this provider.
+        A hung service costs at most this long instead of the 25 s D-Bus default. */
+    int callTimeout() const { return m_callTimeout; }
+    void setCallTimeout(int msecs) { m_callTimeout = msecs; }
+
+    /*! False while the circuit is open: the service timed out repeatedly and Power skips
+        the provider until a background Peer.Ping sees it answer again. */
+    bool isHealthy() const { return m_healthy; }
+
+    /// Health, last call latency and timeout count, exported in the session state.
+    QVariantMap health() const;
+
+    /// Records the reply of a call made by the provider, taking latencyMsecs.
+    void recordCall(const QDBusMessage &reply, qint64 latencyMsecs);
+
     /*! Returns true if the Power can perform action.
+        Not const, the calls it makes feed the circuit breaker.
         This is a pure virtual function, and must be reimplemented in subclasses. */
-    virtual bool canAction(Power::Action action) const = 0 ;
+    virtual bool canAction(Power::Action action) = 0 ;
+
+    /*! Returns the short name of the provider, used to label metrics. */
+    virtual QString name() const = 0;
 
 public Q_SLOTS:
     /*! Performs the requested action.
         This is a pure virtual function, and must be reimplemented in subclasses. */
     virtual bool doAction(Power::Action action) = 0;
+
+Q_SIGNALS:
+    void healthChanged(bool healthy);
+
+protected:
+    /// The system bus name probed while the circuit is open, empty if there is none.
+    virtual QString service() const { return QString(); }
+
+private:
+    void setHealthy(bool healthy);
+    void probe();
+
+    int m_callTimeout;
+    bool m_healthy;
+    int m_timeouts;
+    qint64 m_lastLatency;
+    QTimer *m_probeTimer;
 };
 
 
@@ -59,10 +99,30 @@ class UPowerProvider: public PowerProvider
 public:
     UPowerProvider(QObject *parent = nullptr);
     ~UPowerProvider() override;
-    bool canAction(Power::Action action) const override;
+    bool canAction(Power::Action action) override;
+    QString name() const override { return QStringLiteral("upower"); }
+
+    /*! Returns UPower's OnBattery property, kept up to date from PropertiesChanged.
+        Until UPower answers, the state is read from /sys/class/power_supply. */
+    bool onBattery() const { return m_onBattery; }
 
 public Q_SLOTS:
     bool doAction(Power::Action action) override;
+
+Q_SIGNALS:
+    void onBatteryChanged(bool onBattery);
+
+protected:
+    QString service() const override;
+
+private Q_SLOTS:
+    void propertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &invalidated);
+
+private:
+    void setOnBattery(bool onBattery);
+    void queryOnBattery();
+
+    bool m_onBattery;
 };
 
 
@@ -73,7 +133,11 @@ class ConsoleKitProvider: public PowerProvider
 public:
     ConsoleKitProvider(QObject *parent = nullptr);
     ~ConsoleKitProvider() override;
-    bool canAction(Power::Action action) const override;
+    bool canAction(Power::Action action) override;
+    QString name() const override { return QStringLiteral("consolekit"); }
+
+protected:
+    QString service() const override;
 
 public Q_SLOTS:
     bool doAction(Power::Action action) override;
@@ -87,7 +151,11 @@ class SystemdProvider: public PowerProvider
 public:
     SystemdProvider(QObject *parent = nullptr);
     ~SystemdProvider() override;
-    bool canAction(Power::Action action) const override;
+    bool canAction(Power::Action action) override;
+    QString name() const override { return QStringLiteral("systemd"); }
+
+protected:
+    QString service() const override;
 
 public Q_SLOTS:
     bool doAction(Power::Action action) override;
@@ -100,7 +168,8 @@ class HalProvider: public PowerProvider
 public:
     HalProvider(QObject *parent = nullptr);
     ~HalProvider() override;
-    bool canAction(Power::Action action) const override;
+    bool canAction(Power::Action action) override;
+    QString name() const override { return QStringLiteral("hal"); }
 
 public Q_SLOTS:
     bool doAction(Power::Action action) override;
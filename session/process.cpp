@@ -1,5 +1,26 @@
 #include "process.h"
 
+#include <QSocketNotifier>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int pidfdOpen(qint64 pid)
+{
+#ifdef SYS_pidfd_open
+    return int(::syscall(SYS_pidfd_open, pid_t(pid), 0));
+#else
+    Q_UNUSED(pid)
+    return -1;
+#endif
+}
+
 Process::Process(QObject *parent)
     : QProcess(parent)
 {
@@ -12,3 +33,90 @@ void Process::init()
 {
     setProcessChannelMode(QProcess::ForwardedChannels);
 }
+
+AdoptedProcess::AdoptedProcess(qint64 pid, const QString &kind, const QString &name, QObject *parent)
+    : QObject(parent)
+    , m_pid(pid)
+    , m_kind(kind)
+    , m_name(name)
+    , m_pidfd(pidfdOpen(pid))
+    , m_notifier(nullptr)
+    , m_running(true)
+{
+    if (m_pidfd >= 0) {
+        m_notifier = new QSocketNotifier(m_pidfd, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &AdoptedProcess::reap);
+    } else {
+        // Kernels without pidfd_open(): poll the child instead.
+        QTimer *timer = new QTimer(this);
+        connect(timer, &QTimer::timeout, this, &AdoptedProcess::reap);
+        timer->start(1000);
+    }
+
+    // The process may already have exited while the session was re-executing.
+    QTimer::singleShot(0, this, &AdoptedProcess::reap);
+}
+
+AdoptedProcess::~AdoptedProcess()
+{
+    if (m_pidfd >= 0)
+        ::close(m_pidfd);
+}
+
+void AdoptedProcess::terminate()
+{
+    if (m_running)
+        ::kill(pid_t(m_pid), SIGTERM);
+}
+
+void AdoptedProcess::kill()
+{
+    if (m_running)
+        ::kill(pid_t(m_pid), SIGKILL);
+}
+
+bool AdoptedProcess::waitForFinished(int msecs)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    while (m_running) {
+        const int remaining = msecs < 0 ? -1 : int(qMax<qint64>(msecs - timer.elapsed(), 0));
+        if (m_pidfd >= 0) {
+            pollfd fd = { m_pidfd, POLLIN, 0 };
+            ::poll(&fd, 1, remaining);
+        } else {
+            QThread::msleep(50);
+        }
+
+        reap();
+        if (m_running && msecs >= 0 && timer.elapsed() >= msecs)
+            return false;
+    }
+
+    return true;
+}
+
+void AdoptedProcess::reap()
+{
+    if (!m_running)
+        return;
+
+    int status;
+    const pid_t result = ::waitpid(pid_t(m_pid), &status, WNOHANG);
+    if (result == 0)
+        return;
+
+    m_running = false;
+    if (m_notifier)
+        m_notifier->setEnabled(false);
+
+    if (result < 0) {
+        // Not our child any more, nothing to report.
+        emit finished(-1, QProcess::CrashExit);
+    } else if (WIFEXITED(status)) {
+        emit finished(WEXITSTATUS(status), QProcess::NormalExit);
+    } else {
+        emit finished(-1, QProcess::CrashExit);
+    }
+}
@@ -3,6 +3,8 @@
 
 #include <QProcess>
 
+class QSocketNotifier;
+
 class Process : public QProcess
 {
     Q_OBJECT
@@ -15,4 +17,39 @@ private:
     void init();
 };
 
+/*! A child process inherited across a re-exec of the session, known only by its PID.
+    Exits are noticed through a pidfd, the process is reaped like QProcess would.
+*/
+class AdoptedProcess : public QObject
+{
+    Q_OBJECT
+
+public:
+    AdoptedProcess(qint64 pid, const QString &kind, const QString &name, QObject *parent = nullptr);
+    ~AdoptedProcess() override;
+
+    qint64 processId() const { return m_pid; }
+    QString kind() const { return m_kind; }
+    QString name() const { return m_name; }
+    bool isRunning() const { return m_running; }
+
+    void terminate();
+    void kill();
+    bool waitForFinished(int msecs);
+
+signals:
+    void finished(int exitCode, QProcess::ExitStatus exitStatus);
+
+private slots:
+    void reap();
+
+private:
+    qint64 m_pid;
+    QString m_kind;
+    QString m_name;
+    int m_pidfd;
+    QSocketNotifier *m_notifier;
+    bool m_running;
+};
+
 #endif // PROCESS_H
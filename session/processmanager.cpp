@@ -1,17 +1,39 @@
 #include "processmanager.h"
+#include "activationclaim.h"
+#include "admissioncontroller.h"
+#include "autostarthistory.h"
+#include "cachewarmup.h"
+#include "healthmonitor.h"
+#include "windowtracker.h"
+#include "desktopindex.h"
+#include "sessionmetrics.h"
+#include "sessionrestore.h"
+#include "process.h"
+#include "zygoteclient.h"
+#include "powermanager/powerprofiles.h"
 
 #include <QCoreApplication>
+#include <QDBusServiceWatcher>
+#include <QSocketNotifier>
 #include <QStandardPaths>
 #include <QFileInfoList>
 #include <QFileInfo>
-#include <QSettings>
+#include <QElapsedTimer>
 #include <QDebug>
 #include <QTimer>
 #include <QThread>
 #include <QDir>
+#include <QFile>
 #include <syslog.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <QProcessEnvironment>
 
+// The startup continues without the compositor if it is not ready by then.
+static const int compositorTimeout = 30 * 1000;
+// How often kwin's children are checked for Xwayland until it started.
+static const int xwaylandPollInterval = 5 * 1000;
+
 void customMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
     QByteArray localMsg = msg.toLocal8Bit();
@@ -39,9 +61,25 @@ void customMessageHandler(QtMsgType type, const QMessageLogContext &context, con
 
 ProcessManager::ProcessManager(QObject *parent)
     : QObject(parent)
+    , m_wmProcess(nullptr)
+    , m_desktopIndex(new DesktopIndex(this))
+    , m_autostartHistory(new AutostartHistory(this))
+    , m_admission(new AdmissionController(this))
+    , m_health(new HealthMonitor(this))
+    , m_cacheWarmup(new CacheWarmup(this))
+    , m_windows(new WindowTracker(this))
+    , m_zygote(new ZygoteClient(this))
+    , m_profileHold(new PowerProfileHold(this))
+    , m_environment(QProcessEnvironment::systemEnvironment())
+    , m_phase(Initializing)
+    , m_x11Active(false)
+    , m_onBattery(false)
     , m_wmStarted(false)
-    , m_waitLoop(nullptr)
+    , m_shellStarted(false)
+    , m_x11Poll(nullptr)
 {
+    connect(m_health, &HealthMonitor::unresponsive, this, &ProcessManager::restartComponent);
+
     // Wayland doesn't require a native event filter
     qInstallMessageHandler(customMessageHandler);
     qDebug() << "ProcessManager created";
@@ -60,14 +98,157 @@ ProcessManager::~ProcessManager()
 
 void ProcessManager::start()
 {
+    // Login is the busiest moment of the session, run it in the performance profile.
+    m_profileHold->hold(QStringLiteral("performance"), QStringLiteral("Session startup"), 60 * 1000);
+
+    m_manifest = SessionManifest::load();
+    m_background.init();
+    applySchedulingProfile();
+
+    // Caches are checked and read ahead in the background while the compositor starts.
+    if (m_manifest.profile(m_onBattery).cacheWarmup)
+        m_cacheWarmup->start(m_environment);
+
+    // Let the zygote map Qt while the compositor initializes.
+    startZygote();
     startWindowManager();
+
+    // The shell connects to the socket kwin was handed and waits in its listen backlog
+    // until the compositor accepts, both initialize in parallel. Without our own socket
+    // the clients cannot know the display name before kwin is up.
+    if (m_waylandSocket.isValid())
+        startShell();
+
+    // The phases and the autostart entries continue in compositorReady().
+}
+
+void ProcessManager::startShell()
+{
+    if (m_shellStarted)
+        return;
+
+    m_shellStarted = true;
     loadSystemProcess();
+}
+
+void ProcessManager::compositorReady()
+{
+    if (m_phase >= CompositorReady)
+        return;
+
+    if (m_wmProcess && m_wmProcess->state() == QProcess::Running) {
+        qDebug() << "Window manager started successfully";
+        m_wmStarted = true;
+        setComponentState(QStringLiteral("kwin_wayland"), QStringLiteral("running"));
+    }
+    setPhase(CompositorReady);
+
+    startShell();
+    setPhase(ShellReady);
+
+    QTimer::singleShot(100, this, [this] {
+        // Running is reached once every autostart entry was admitted and is ready,
+        // except the deferrable ones, which keep starting afterwards.
+        connect(m_admission, &AdmissionController::drained, this, &ProcessManager::autostartDrained, Qt::UniqueConnection);
+        loadAutoStartProcess();
+        restoreSession();
+    });
+}
+
+void ProcessManager::autostartDrained()
+{
+    if (m_phase != ShellReady)
+        return;
+
+    setPhase(Running);
+}
+
+QString ProcessManager::phaseName(Phase phase)
+{
+    switch (phase) {
+    case Initializing: return QStringLiteral("initializing");
+    case CompositorReady: return QStringLiteral("compositor-ready");
+    case ShellReady: return QStringLiteral("shell-ready");
+    case Running: return QStringLiteral("running");
+    case ShuttingDown: return QStringLiteral("shutting-down");
+    }
+    return QString();
+}
+
+int ProcessManager::phaseFromName(const QString &name)
+{
+    for (int phase = Initializing; phase <= ShuttingDown; ++phase) {
+        if (phaseName(Phase(phase)) == name)
+            return phase;
+    }
+    return -1;
+}
+
+void ProcessManager::setPhase(Phase phase)
+{
+    if (phase <= m_phase)
+        return;
+
+    qDebug() << "Session phase:" << phaseName(phase);
+    m_phase = phase;
+
+    if (m_phase >= Running)
+        m_profileHold->release();
+
+    emit phaseChanged(phase);
+}
 
-    QTimer::singleShot(100, this, &ProcessManager::loadAutoStartProcess);
+void ProcessManager::windowShown(const QString &sender, qint64 pid, const QString &desktopFileName)
+{
+    m_windows->windowShown(sender, pid, desktopFileName);
+}
+
+void ProcessManager::setOnBattery(bool onBattery)
+{
+    if (m_onBattery == onBattery)
+        return;
+
+    qDebug() << "Switching to the" << (onBattery ? "battery" : "AC") << "scheduling profile";
+    m_onBattery = onBattery;
+    applySchedulingProfile();
+
+    const bool defer = m_manifest.profile(m_onBattery).deferAutostart;
+    for (const QString &desktopId : qAsConst(m_profileDeferred))
+        m_admission->setFlag(desktopId, AdmissionController::Background, defer);
+}
+
+void ProcessManager::applySchedulingProfile()
+{
+    const SchedulingProfile profile = m_manifest.profile(m_onBattery);
+    m_background.setWeight(profile.backgroundCpuWeight);
+}
+
+void ProcessManager::setComponentState(const QString &component, const QString &state)
+{
+    if (m_componentStates.value(component) == state)
+        return;
+
+    m_componentStates.insert(component, state);
+    emit componentStateChanged(component, state);
 }
 
 void ProcessManager::logout()
 {
+    shutdown();
+    QCoreApplication::exit(0);
+}
+
+void ProcessManager::shutdown()
+{
+    if (m_phase == ShuttingDown)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    setPhase(ShuttingDown);
+    saveSession();
+
     QMapIterator<QString, QProcess *> i(m_systemProcess);
 
     while (i.hasNext()) {
@@ -77,6 +258,17 @@ void ProcessManager::logout()
     }
     i.toFront();
 
+    // Finished launched processes remove themselves from the list, iterate over a copy.
+    const QList<QProcess *> launched = m_launchedProcess;
+    for (QProcess *p : launched)
+        p->terminate();
+
+    const QList<AdoptedProcess *> adopted = m_adoptedProcess;
+    for (AdoptedProcess *p : adopted) {
+        if (p->kind() != QLatin1String("wm"))
+            p->terminate();
+    }
+
     while (i.hasNext()) {
         i.next();
         QProcess *p = i.value();
@@ -85,108 +277,918 @@ void ProcessManager::logout()
         }
     }
 
-    QCoreApplication::exit(0);
+    for (QProcess *p : launched) {
+        if (p->state() != QProcess::NotRunning && !p->waitForFinished(2000))
+            p->kill();
+    }
+
+    for (AdoptedProcess *p : adopted) {
+        if (p->kind() != QLatin1String("wm") && !p->waitForFinished(2000))
+            p->kill();
+    }
+
+    m_zygote->shutdown(2000);
+    m_autostartHistory->save();
+
+    SessionMetrics::self()->histogram("prts_session_logout_duration_seconds",
+                                      "Time taken to stop all session processes on logout.")->observe(timer);
+    SessionMetrics::self()->writeExposition();
+}
+
+void ProcessManager::saveState(QDataStream &out)
+{
+    QList<AdoptedEntry> entries;
+    auto add = [&entries](const QString &kind, const QString &name, QProcess *process) {
+        if (process && process->state() == QProcess::Running)
+            entries << AdoptedEntry { kind, name, process->processId() };
+    };
+
+    add(QStringLiteral("wm"), QStringLiteral("kwin_wayland"), m_wmProcess);
+    for (auto it = m_systemProcess.constBegin(); it != m_systemProcess.constEnd(); ++it)
+        add(QStringLiteral("system"), it.key(), it.value());
+    for (auto it = m_autoStartProcess.constBegin(); it != m_autoStartProcess.constEnd(); ++it)
+        add(QStringLiteral("autostart"), it.key(), it.value());
+    for (QProcess *process : qAsConst(m_launchedProcess))
+        add(QStringLiteral("launch"), process->property("desktopId").toString(), process);
+    for (AdoptedProcess *process : qAsConst(m_adoptedProcess)) {
+        if (process->isRunning())
+            entries << AdoptedEntry { process->kind(), process->name(), process->processId() };
+    }
+
+    m_zygote->prepareForReexec();
+    m_waylandSocket.prepareForReexec();
+    m_x11Socket.prepareForReexec();
+
+    out << m_environment.toStringList() << qint32(m_phase) << m_componentStates << m_wmStarted;
+    out << qint32(entries.size());
+    for (const AdoptedEntry &entry : qAsConst(entries))
+        out << entry.kind << entry.name << entry.pid;
+    out << (m_zygote->isRunning() ? m_zygote->processId() : qint64(0)) << qint32(m_zygote->socket());
+    out << m_zygoteProcess;
+    out << m_waylandSocket.name() << qint32(m_waylandSocket.fd()) << qint32(m_waylandSocket.lockFd());
+    out << qint32(m_x11Socket.display()) << m_x11Socket.fds() << m_x11Socket.xauthority() << m_x11Active;
+}
+
+bool ProcessManager::restoreState(QDataStream &in)
+{
+    QStringList environment;
+    qint32 phase;
+    qint32 count;
+    in >> environment >> phase >> m_componentStates >> m_wmStarted >> count;
+
+    m_environment.clear();
+    for (const QString &variable : qAsConst(environment)) {
+        const int eq = variable.indexOf(QLatin1Char('='));
+        if (eq > 0)
+            m_environment.insert(variable.left(eq), variable.mid(eq + 1));
+    }
+
+    m_phase = Phase(qBound<qint32>(Initializing, phase, ShuttingDown));
+    m_manifest = SessionManifest::load();
+    m_background.init();
+    applySchedulingProfile();
+
+    for (qint32 i = 0; i < count; ++i) {
+        AdoptedEntry entry;
+        in >> entry.kind >> entry.name >> entry.pid;
+        adoptProcess(entry);
+    }
+
+    qint64 zygotePid;
+    qint32 zygoteSocket;
+    in >> zygotePid >> zygoteSocket >> m_zygoteProcess;
+
+    if (m_zygote->adopt(zygotePid, zygoteSocket)) {
+        watchZygote();
+
+        // Children of the zygote are adopted through it, watch them like the other components.
+        for (const SessionComponent &component : m_manifest.components()) {
+            const qint64 pid = m_zygoteProcess.value(component.name);
+            if (pid <= 0)
+                continue;
+            m_health->watch(component);
+            if (component.background)
+                m_background.add(pid);
+        }
+    } else {
+        // The zygote took its children with it.
+        const QStringList lost = m_zygoteProcess.keys();
+        m_zygoteProcess.clear();
+        for (const QString &name : lost)
+            componentFinished(name, true);
+    }
+
+    QString waylandName;
+    qint32 waylandFd;
+    qint32 waylandLockFd;
+    in >> waylandName >> waylandFd >> waylandLockFd;
+    m_waylandSocket.adopt(waylandName, waylandFd, waylandLockFd);
+
+    qint32 x11Display;
+    QList<int> x11Fds;
+    QString xauthority;
+    in >> x11Display >> x11Fds >> xauthority >> m_x11Active;
+    m_x11Socket.adopt(x11Display, x11Fds, xauthority);
+    if (!m_x11Active)
+        watchX11Display();
+
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Session state is truncated";
+        return false;
+    }
+
+    // Claims do not survive exec(), take them again for components that are not running.
+    for (const SessionComponent &component : m_manifest.components()) {
+        if (component.activation.isEmpty())
+            continue;
+
+        bool running = m_zygoteProcess.contains(component.name);
+        for (AdoptedProcess *process : qAsConst(m_adoptedProcess))
+            running = running || (process->kind() == QLatin1String("system") && process->name() == component.name);
+
+        if (running)
+            addActivation(component);
+        else
+            claimActivation(component);
+    }
+
+    qDebug() << "Restored session state:" << phaseName(m_phase) << m_adoptedProcess.size() << "processes";
+    return true;
+}
+
+void ProcessManager::adoptProcess(const AdoptedEntry &entry)
+{
+    AdoptedProcess *process = new AdoptedProcess(entry.pid, entry.kind, entry.name, this);
+    m_adoptedProcess.append(process);
+
+    const QByteArray label = SessionMetrics::label("kind", entry.kind);
+    MetricCounter *exits = SessionMetrics::self()->counter("prts_session_child_exits_total",
+                                                           "Child processes that exited normally.", label);
+    MetricCounter *crashes = SessionMetrics::self()->counter("prts_session_child_crashes_total",
+                                                             "Child processes that crashed or were killed.", label);
+
+    connect(process, &AdoptedProcess::finished, this, [this, process, exits, crashes](int exitCode, QProcess::ExitStatus exitStatus) {
+        qDebug() << "Process finished:" << process->name() << "Exit code:" << exitCode << "Exit status:" << exitStatus;
+
+        if (exitStatus == QProcess::CrashExit)
+            crashes->increment();
+        else
+            exits->increment();
+
+        m_adoptedProcess.removeOne(process);
+        process->deleteLater();
+
+        if (process->kind() == QLatin1String("system"))
+            componentFinished(process->name(), exitStatus == QProcess::CrashExit);
+        else if (process->kind() == QLatin1String("wm"))
+            setComponentState(QStringLiteral("kwin_wayland"),
+                              exitStatus == QProcess::NormalExit ? QStringLiteral("stopped") : QStringLiteral("failed"));
+    });
+
+    if (entry.kind == QLatin1String("autostart"))
+        m_background.add(entry.pid);
+
+    if (entry.kind != QLatin1String("system"))
+        return;
+    for (const SessionComponent &component : m_manifest.components()) {
+        if (component.name != entry.name)
+            continue;
+        m_health->watch(component);
+        if (component.background)
+            m_background.add(entry.pid);
+    }
+}
+
+bool ProcessManager::createWaylandSocket()
+{
+    if (!m_waylandSocket.create()) {
+        qWarning() << "Could not create the Wayland socket, the compositor will create its own";
+        return false;
+    }
+    return true;
+}
+
+bool ProcessManager::createX11Display()
+{
+    if (!m_x11Socket.create()) {
+        qWarning() << "Could not reserve an X11 display, X11 clients will not work";
+        return false;
+    }
+
+    watchX11Display();
+    return true;
+}
+
+void ProcessManager::watchX11Display()
+{
+    // The compositor accepts on the same sockets and may take a connection before we wake up.
+    // The notifiers are only the fast path, Xwayland showing up under kwin is the reliable one.
+    for (int fd : m_x11Socket.fds()) {
+        QSocketNotifier *notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        m_x11Notifiers.append(notifier);
+        connect(notifier, &QSocketNotifier::activated, this, [this] {
+            qDebug() << "First X11 client connected to" << m_x11Socket.name();
+            setX11Active();
+        });
+    }
+
+    m_x11Poll = new QTimer(this);
+    m_x11Poll->setTimerType(Qt::CoarseTimer);
+    m_x11Poll->setInterval(xwaylandPollInterval);
+    connect(m_x11Poll, &QTimer::timeout, this, [this] {
+        if (hasXwaylandChild(windowManagerPid())) {
+            qDebug() << "Xwayland started for" << m_x11Socket.name();
+            setX11Active();
+        }
+    });
+    m_x11Poll->start();
+}
+
+void ProcessManager::setX11Active()
+{
+    qDeleteAll(m_x11Notifiers);
+    m_x11Notifiers.clear();
+    if (m_x11Poll)
+        m_x11Poll->deleteLater();
+    m_x11Poll = nullptr;
+
+    if (m_x11Active)
+        return;
+
+    m_x11Active = true;
+    emit x11ActiveChanged(true);
+}
+
+qint64 ProcessManager::windowManagerPid() const
+{
+    if (m_wmProcess && m_wmProcess->state() == QProcess::Running)
+        return m_wmProcess->processId();
+
+    for (AdoptedProcess *process : m_adoptedProcess) {
+        if (process->kind() == QLatin1String("wm") && process->isRunning())
+            return process->processId();
+    }
+    return 0;
+}
+
+bool ProcessManager::hasXwaylandChild(qint64 pid)
+{
+    if (pid <= 0)
+        return false;
+
+    // Any thread of kwin may have forked Xwayland, each lists its own children.
+    const QDir tasks(QStringLiteral("/proc/%1/task").arg(pid));
+    for (const QString &task : tasks.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QFile children(tasks.filePath(task + QStringLiteral("/children")));
+        if (!children.open(QIODevice::ReadOnly))
+            continue;
+
+        for (const QByteArray &child : children.readAll().split(' ')) {
+            if (child.trimmed().isEmpty())
+                continue;
+            QFile comm(QStringLiteral("/proc/%1/comm").arg(QString::fromLatin1(child.trimmed())));
+            if (comm.open(QIODevice::ReadOnly) && comm.readAll().trimmed() == "Xwayland")
+                return true;
+        }
+    }
+    return false;
+}
+
+void ProcessManager::setEnvironment(const QProcessEnvironment &environment)
+{
+    m_environment = environment;
+}
+
+QStringList ProcessManager::windowManagerArguments(const QString &waylandName, int waylandFd,
+                                                   const QString &x11Display, const QList<int> &x11Fds,
+                                                   const QString &xauthority)
+{
+    QStringList arguments;
+
+    if (!x11Display.isEmpty() && !x11Fds.isEmpty()) {
+        arguments << QStringLiteral("--xwayland")
+                  << QStringLiteral("--xwayland-display") << x11Display;
+        if (!xauthority.isEmpty())
+            arguments << QStringLiteral("--xwayland-xauthority") << xauthority;
+        for (int fd : x11Fds)
+            arguments << QStringLiteral("--xwayland-fd") << QString::number(fd);
+    }
+
+    if (!waylandName.isEmpty() && waylandFd >= 0) {
+        arguments << QStringLiteral("--wayland-fd") << QString::number(waylandFd)
+                  << QStringLiteral("--socket") << waylandName;
+    }
+
+    return arguments;
 }
 
 void ProcessManager::startWindowManager()
 {
     qDebug() << "Starting window manager";
     QProcess *wmProcess = new QProcess;
-    wmProcess->start("kwin_wayland", QStringList());
+    m_wmProcess = wmProcess;
+    trackProcess(wmProcess, QStringLiteral("wm"));
+    connect(wmProcess, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), this,
+            [this](int, QProcess::ExitStatus exitStatus) {
+        setComponentState(QStringLiteral("kwin_wayland"),
+                          exitStatus == QProcess::NormalExit ? QStringLiteral("stopped") : QStringLiteral("failed"));
+    });
+    setComponentState(QStringLiteral("kwin_wayland"), QStringLiteral("starting"));
 
-    QEventLoop waitLoop;
-    m_waitLoop = &waitLoop;
-    // add a timeout to avoid infinite blocking if a WM fail to execute.
-    QTimer::singleShot(30 * 1000, &waitLoop, SLOT(quit()));
-    waitLoop.exec();
-    m_waitLoop = nullptr;
+    // WAYLAND_DISPLAY or DISPLAY in its environment would make kwin run nested.
+    QProcessEnvironment environment = m_environment;
+    environment.remove(QStringLiteral("WAYLAND_DISPLAY"));
+    environment.remove(QStringLiteral("DISPLAY"));
+    wmProcess->setProcessEnvironment(environment);
 
-    if (wmProcess->state() == QProcess::Running) {
-        qDebug() << "Window manager started successfully";
-        m_wmStarted = true;
-    } else {
+    QList<int> inherited;
+    if (m_x11Socket.isValid())
+        inherited << m_x11Socket.fds();
+    if (m_waylandSocket.isValid())
+        inherited << m_waylandSocket.fd();
+
+    const QStringList arguments = windowManagerArguments(
+                m_waylandSocket.isValid() ? m_waylandSocket.name() : QString(), m_waylandSocket.fd(),
+                x11Display(), m_x11Socket.isValid() ? m_x11Socket.fds() : QList<int>(), xauthority());
+
+    wmProcess->setChildProcessModifier([inherited] {
+        for (int fd : inherited)
+            ::fcntl(fd, F_SETFD, 0);
+    });
+
+    // kwin registers its bus name once the compositor is up. Clients that connect
+    // to our socket before that wait in the listen backlog.
+    QDBusServiceWatcher *watcher = new QDBusServiceWatcher(QStringLiteral("org.kde.KWin"), QDBusConnection::sessionBus(),
+                                                           QDBusServiceWatcher::WatchForRegistration, wmProcess);
+    connect(watcher, &QDBusServiceWatcher::serviceRegistered, this, &ProcessManager::compositorReady);
+
+    connect(wmProcess, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart)
+            return;
         qDebug() << "Failed to start window manager";
-    }
+        setComponentState(QStringLiteral("kwin_wayland"), QStringLiteral("failed"));
+        compositorReady();
+    });
+
+    QTimer::singleShot(compositorTimeout, this, [this] {
+        if (m_phase < CompositorReady) {
+            qWarning() << "Window manager did not become ready in time, continuing";
+            compositorReady();
+        }
+    });
+
+    wmProcess->start(QStringLiteral("kwin_wayland"), arguments);
 }
 
 void ProcessManager::loadSystemProcess()
 {
-    QList<QPair<QString, QStringList>> list;
-    list << qMakePair(QString("/usr/bin/firefox"), QStringList());
-
-    for (QPair<QString, QStringList> pair : list) {
-        QProcess *process = new QProcess;
-        process->setProcessChannelMode(QProcess::ForwardedChannels);
-        process->setProgram(pair.first);
-        process->setArguments(pair.second);
-        
-        // Set up environment variables
-        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
-        process->setProcessEnvironment(env);
-
-        connect(process, &QProcess::readyReadStandardOutput, [process]() {
-            qDebug() << "Standard Output:" << process->readAllStandardOutput();
-        });
-        connect(process, &QProcess::readyReadStandardError, [process]() {
-            qDebug() << "Standard Error:" << process->readAllStandardError();
-        });
-        connect(process, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), 
-                [pair](int exitCode, QProcess::ExitStatus exitStatus) {
-            qDebug() << "Process finished:" << pair.first << "Exit code:" << exitCode << "Exit status:" << exitStatus;
-        });
+    const QList<SessionComponent> components = m_manifest.components();
 
-        process->start();
-        if (!process->waitForStarted()) {
-            qDebug() << "Failed to start process:" << pair.first << process->errorString();
-            delete process;
+    for (const SessionComponent &component : components) {
+        if (!component.activation.isEmpty() && claimActivation(component))
             continue;
-        } else {
-            qDebug() << "Load DE components: " << pair.first << pair.second;
-        }
+        startComponent(component);
+    }
+}
+
+ActivationClaim *ProcessManager::addActivation(const SessionComponent &component)
+{
+    ActivationClaim *claim = m_activation.value(component.name);
+    if (claim)
+        return claim;
+
+    claim = new ActivationClaim(component, this);
+    connect(claim, &ActivationClaim::activated, this, [this, component] {
+        qDebug() << "First use of" << component.name;
+        startComponent(component);
+    });
+    m_activation.insert(component.name, claim);
+    return claim;
+}
+
+bool ProcessManager::claimActivation(const SessionComponent &component)
+{
+    ActivationClaim *claim = addActivation(component);
+    if (!claim->claim()) {
+        // Someone else already provides it, keep the component eagerly started as before.
+        m_activation.remove(component.name);
+        delete claim;
+        return false;
+    }
+
+    setComponentState(component.name, QStringLiteral("waiting"));
+    return true;
+}
+
+void ProcessManager::startComponent(const SessionComponent &component)
+{
+    ActivationClaim *claim = m_activation.value(component.name);
+
+    // The zygote cannot pass the activation socket on.
+    if (!claim && !component.zygoteModule.isEmpty() && m_zygote->isRunning()) {
+        spawnFromZygote(component);
+        return;
+    }
+
+    QProcess *process = new QProcess;
+    process->setProperty("component", component.name);
+    process->setProcessChannelMode(QProcess::ForwardedChannels);
+    process->setProgram(component.program);
+    process->setArguments(component.arguments);
+
+    process->setProcessEnvironment(m_environment);
+
+    if (claim)
+        claim->handOver();
+
+    if (claim && !claim->isDBus()) {
+        // LISTEN_PID has to be the component's own PID, a shell sets it and execs in place.
+        QProcessEnvironment environment = m_environment;
+        environment.insert(QStringLiteral("LISTEN_FDS"), QStringLiteral("1"));
+        environment.insert(QStringLiteral("LISTEN_FDNAMES"), component.name);
+        process->setProcessEnvironment(environment);
+        process->setProgram(QStringLiteral("/bin/sh"));
+        process->setArguments(QStringList { QStringLiteral("-c"), QStringLiteral("export LISTEN_PID=$$; exec \"$0\" \"$@\""),
+                                            component.program } + component.arguments);
 
+        const int fd = claim->socket();
+        process->setChildProcessModifier([fd] {
+            if (fd == 3)
+                ::fcntl(fd, F_SETFD, 0);
+            else
+                ::dup2(fd, 3);
+        });
+    }
+    trackProcess(process, QStringLiteral("system"));
 
-        if (process->state() == QProcess::Running) {
-            m_autoStartProcess.insert(pair.first, process);
-        } else {
+    connect(process, &QProcess::readyReadStandardOutput, [process]() {
+        qDebug() << "Standard Output:" << process->readAllStandardOutput();
+    });
+    connect(process, &QProcess::readyReadStandardError, [process]() {
+        qDebug() << "Standard Error:" << process->readAllStandardError();
+    });
+    connect(process, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), this,
+            [this, component, process](int exitCode, QProcess::ExitStatus exitStatus) {
+        qDebug() << "Process finished:" << component.name << "Exit code:" << exitCode << "Exit status:" << exitStatus;
+        if (m_systemProcess.value(component.name) == process) {
+            m_systemProcess.remove(component.name);
             process->deleteLater();
         }
+        componentFinished(component.name, exitStatus == QProcess::CrashExit);
+    });
+
+    setComponentState(component.name, QStringLiteral("starting"));
+    process->start();
+    if (!process->waitForStarted()) {
+        qDebug() << "Failed to start process:" << component.program << process->errorString();
+        setComponentState(component.name, QStringLiteral("failed"));
+        delete process;
+        return;
     }
+
+    qDebug() << "Load DE components: " << component.program << component.arguments;
+    setComponentState(component.name, QStringLiteral("running"));
+    m_systemProcess.insert(component.name, process);
+    m_health->watch(component);
+    if (component.background)
+        m_background.add(process->processId());
 }
 
-void ProcessManager::loadAutoStartProcess()
+void ProcessManager::componentFinished(const QString &name, bool crashed)
+{
+    m_health->unwatch(name);
+    setComponentState(name, crashed ? QStringLiteral("failed") : QStringLiteral("stopped"));
+
+    if (m_phase >= ShuttingDown)
+        return;
+
+    if (!m_restartPending.remove(name)) {
+        // Activatable components are started again by their next client.
+        if (ActivationClaim *claim = m_activation.value(name)) {
+            if (claim->claim())
+                setComponentState(name, QStringLiteral("waiting"));
+        }
+        return;
+    }
+
+    for (const SessionComponent &component : m_manifest.components()) {
+        if (component.name != name)
+            continue;
+
+        qDebug() << "Restarting unresponsive component" << name;
+        SessionMetrics::self()->counter("prts_session_child_restarts_total", "Child processes restarted by the session.",
+                                        SessionMetrics::label("kind", QStringLiteral("system")))->increment();
+        startComponent(component);
+        return;
+    }
+}
+
+void ProcessManager::restartComponent(const QString &name)
 {
-    QStringList execList;
-    const QStringList dirs = QStandardPaths::locateAll(QStandardPaths::GenericConfigLocation,
-                                                       QStringLiteral("autostart"),
-                                                       QStandardPaths::LocateDirectory);
+    if (m_phase >= ShuttingDown || m_restartPending.contains(name))
+        return;
+
+    // The hung process is killed, componentFinished() starts it again once it is gone.
+    if (QProcess *process = m_systemProcess.value(name)) {
+        m_restartPending.insert(name);
+        process->kill();
+        return;
+    }
+
+    if (m_zygoteProcess.contains(name)) {
+        m_restartPending.insert(name);
+        ::kill(pid_t(m_zygoteProcess.value(name)), SIGKILL);
+        return;
+    }
+
+    for (AdoptedProcess *process : qAsConst(m_adoptedProcess)) {
+        if (process->kind() == QLatin1String("system") && process->name() == name) {
+            m_restartPending.insert(name);
+            process->kill();
+            return;
+        }
+    }
+}
+
+QMap<QString, DesktopFile> ProcessManager::readAutoStartEntries(const QStringList &dirs)
+{
+    // Directories are ordered by priority, the user's copy of an entry hides the system one.
+    QMap<QString, DesktopFile> entries;
     for (const QString &dir : dirs) {
         const QDir d(dir);
-        const QStringList fileNames = d.entryList(QStringList() << QStringLiteral("*.desktop"));
+        const QStringList fileNames = d.entryList(QStringList() << QStringLiteral("*.desktop"), QDir::Files);
         for (const QString &file : fileNames) {
-            QSettings desktop(d.absoluteFilePath(file), QSettings::IniFormat);
-            desktop.beginGroup("Desktop Entry");
+            if (!entries.contains(file))
+                entries.insert(file, DesktopFile::fromFile(d.absoluteFilePath(file)));
+        }
+    }
+    return entries;
+}
 
-            if (desktop.contains("OnlyShowIn"))
-                continue;
+void ProcessManager::loadAutoStartProcess()
+{
+    const QMap<QString, DesktopFile> entries = readAutoStartEntries(
+                QStandardPaths::locateAll(QStandardPaths::GenericConfigLocation, QStringLiteral("autostart"),
+                                          QStandardPaths::LocateDirectory));
 
-            const QString execValue = desktop.value("Exec").toString();
+    const QString desktop = m_environment.value(QStringLiteral("XDG_CURRENT_DESKTOP"));
+    m_autostartHistory->load();
 
-            if (!execValue.isEmpty()) {
-                execList << execValue;
-            }
+    QStringList order;
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const DesktopFile &entry = it.value();
+        if (!entry.isValid() || !entry.isShownIn(desktop) || entry.execArguments().isEmpty())
+            continue;
+
+        const QString desktopId = it.key().chopped(8);
+        if (m_autostartHistory->isHeldBack(desktopId, QFileInfo(entry.fileName()).lastModified())) {
+            qWarning() << "Holding back autostart entry that keeps crashing:" << desktopId;
+            continue;
         }
+
+        order << desktopId;
     }
+    m_autostartEntries = QSet<QString>(order.constBegin(), order.constEnd());
 
-    for (const QString &exec : execList) {
-        QProcess *process = new QProcess;
-        process->setProgram(exec);
-        process->start();
-        process->waitForStarted();
+    // Cheap entries first, heavy ones later and one at a time.
+    m_autostartHistory->sort(order);
+    connect(m_autostartHistory, &AutostartHistory::ready, m_admission, &AdmissionController::release, Qt::UniqueConnection);
+    connect(m_autostartHistory, &AutostartHistory::measured, m_admission, &AdmissionController::release, Qt::UniqueConnection);
 
-        if (process->state() == QProcess::Running) {
-            m_autoStartProcess.insert(exec, process);
-        } else {
-            process->deleteLater();
+    const SchedulingProfile profile = m_manifest.profile(m_onBattery);
+    QList<AdmissionController::Request> requests;
+    for (const QString &desktopId : qAsConst(order)) {
+        const DesktopFile entry = entries.value(desktopId + QStringLiteral(".desktop"));
+
+        AdmissionController::Flags flags;
+        if (m_autostartHistory->isHeavy(desktopId))
+            flags |= AdmissionController::Exclusive;
+        if (entry.boolValue(QStringLiteral("X-PRTS-Deferrable")))
+            flags |= AdmissionController::Deferrable;
+        // The profile only lowers their concurrency, setOnBattery() updates queued entries.
+        if (!entry.boolValue(QStringLiteral("X-PRTS-Essential"))) {
+            m_profileDeferred.insert(desktopId);
+            if (profile.deferAutostart)
+                flags |= AdmissionController::Background;
         }
+
+        requests << AdmissionController::Request { desktopId, [this, desktopId, entry] { startAutoStartEntry(desktopId, entry); }, flags };
+    }
+
+    m_admission->enqueueBatch(requests);
+}
+
+void ProcessManager::startAutoStartEntry(const QString &desktopId, const DesktopFile &entry)
+{
+    QStringList args = entry.execArguments();
+
+    Process *process = new Process(this);
+    process->setProperty("desktopId", desktopId);
+    process->setProgram(args.takeFirst());
+    process->setArguments(args);
+    process->setProcessEnvironment(m_environment);
+
+    const QString workingDirectory = entry.value(QStringLiteral("Path"));
+    if (!workingDirectory.isEmpty())
+        process->setWorkingDirectory(workingDirectory);
+
+    trackProcess(process, QStringLiteral("autostart"));
+    m_autostartHistory->watch(desktopId, process);
+    m_autoStartProcess.insert(desktopId, process);
+
+    // Autostart entries always count as background work.
+    // The PID is gone once the process finished, keep it around for remove().
+    connect(process, &QProcess::started, this, [this, process] {
+        process->setProperty("pid", process->processId());
+        m_background.add(process->processId());
+    });
+    connect(process, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), this, [this, process] {
+        m_background.remove(process->property("pid").toLongLong());
+    });
+    connect(process, &QProcess::errorOccurred, this, [this, process, desktopId](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart)
+            return;
+        qWarning() << "Failed to start autostart entry" << desktopId << process->errorString();
+        m_admission->release(desktopId);
+        m_autoStartProcess.remove(desktopId);
+        process->deleteLater();
+    });
+
+    qDebug() << "Autostart" << desktopId << process->program() << process->arguments();
+    process->start();
+}
+
+void ProcessManager::saveSession()
+{
+    if (!SessionRestore::isEnabled())
+        return;
+
+    QStringList components;
+    for (auto it = m_activation.constBegin(); it != m_activation.constEnd(); ++it) {
+        if (m_componentStates.value(it.key()) == QLatin1String("running"))
+            components << it.key();
     }
+
+    // Applications adopted across a re-exec were launched before the ones started since.
+    QStringList launched;
+    for (AdoptedProcess *process : qAsConst(m_adoptedProcess)) {
+        if (process->kind() == QLatin1String("launch") && process->isRunning())
+            launched << process->name();
+    }
+    for (QProcess *process : qAsConst(m_launchedProcess)) {
+        if (process->state() == QProcess::Running)
+            launched << process->property("desktopId").toString();
+    }
+
+    QStringList applications;
+    for (const QString &desktopId : qAsConst(launched)) {
+        if (applications.contains(desktopId))
+            continue;
+        if (!m_desktopIndex->find(desktopId).boolValue(QStringLiteral("X-PRTS-Restore"), true))
+            continue;
+        applications << desktopId;
+    }
+
+    SessionRestore restore;
+    restore.setComponents(components);
+    restore.setApplications(applications);
+    restore.save();
+
+    qDebug() << "Saved session for restore:" << components << applications;
+}
+
+void ProcessManager::restoreSession()
+{
+    SessionRestore restore;
+    if (!SessionRestore::isEnabled() || !restore.load())
+        return;
+
+    // Queued right behind the autostart entries in the old order, as background admission
+    // requests that take at most half of the launch slots so the autostart entries can overtake them.
+    // Only the admission is background, the processes keep the session's CPU weight.
+    QList<AdmissionController::Request> requests;
+
+    const QStringList components = restore.components();
+    for (const SessionComponent &component : m_manifest.components()) {
+        if (!components.contains(component.name) || m_componentStates.value(component.name) != QLatin1String("waiting"))
+            continue;
+
+        requests << AdmissionController::Request { component.name, [this, component] {
+            if (m_componentStates.value(component.name) == QLatin1String("waiting"))
+                startComponent(component);
+            m_admission->release(component.name);
+        }, AdmissionController::Background };
+    }
+
+    const QStringList applications = restore.applications();
+    for (const QString &desktopId : applications) {
+        // Autostart starts it anyway, or it opted out since.
+        if (m_autostartEntries.contains(desktopId))
+            continue;
+        if (!m_desktopIndex->find(desktopId).boolValue(QStringLiteral("X-PRTS-Restore"), true))
+            continue;
+
+        requests << AdmissionController::Request { desktopId, [this, desktopId] {
+            QProcess *process = launch(desktopId);
+            if (!process) {
+                m_admission->release(desktopId);
+                return;
+            }
+            // Restored applications are interactive, they stay out of the background group.
+            connect(process, &QProcess::started, this, [this, desktopId] {
+                m_admission->release(desktopId);
+            });
+            connect(process, &QProcess::errorOccurred, this, [this, desktopId](QProcess::ProcessError error) {
+                if (error == QProcess::FailedToStart)
+                    m_admission->release(desktopId);
+            });
+        }, AdmissionController::Background };
+    }
+
+    qDebug() << "Restoring" << requests.size() << "components and applications";
+    m_admission->enqueueBatch(requests);
+}
+
+QProcess *ProcessManager::launch(const QString &desktopId, const QStringList &urls)
+{
+    const DesktopFile entry = m_desktopIndex->find(desktopId);
+    QStringList args = entry.execArguments(urls);
+
+    if (!entry.isValid() || args.isEmpty()) {
+        qWarning() << "Cannot launch unknown desktop entry" << desktopId;
+        return nullptr;
+    }
+    if (!entry.isLaunchable()) {
+        qWarning() << "Cannot launch hidden or uninstalled desktop entry" << desktopId;
+        return nullptr;
+    }
+
+    Process *process = new Process(this);
+    process->setProperty("desktopId", desktopId);
+    process->setProgram(args.takeFirst());
+    process->setArguments(args);
+    process->setProcessEnvironment(m_environment);
+
+    const QString workingDirectory = entry.value(QStringLiteral("Path"));
+    if (!workingDirectory.isEmpty())
+        process->setWorkingDirectory(workingDirectory);
+
+    trackProcess(process, QStringLiteral("launch"));
+    m_launchedProcess.append(process);
+
+    auto cleanup = [this, process] {
+        m_launchedProcess.removeOne(process);
+        process->deleteLater();
+    };
+    connect(process, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), this, cleanup);
+    connect(process, &QProcess::errorOccurred, this, [process, cleanup, desktopId](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart)
+            return;
+        qWarning() << "Failed to launch" << desktopId << process->errorString();
+        cleanup();
+    });
+
+    qDebug() << "Launching" << desktopId << process->program() << process->arguments();
+    QMetaObject::invokeMethod(process, [process] { process->start(); }, Qt::QueuedConnection);
+
+    return process;
+}
+
+void ProcessManager::startZygote()
+{
+    bool wanted = false;
+    for (const SessionComponent &component : m_manifest.components())
+        wanted = wanted || !component.zygoteModule.isEmpty();
+
+    if (!wanted || !ZygoteClient::isAvailable())
+        return;
+
+    if (m_zygote->start(m_environment))
+        watchZygote();
+}
+
+void ProcessManager::watchZygote()
+{
+    const QByteArray label = SessionMetrics::label("kind", QStringLiteral("zygote"));
+    MetricCounter *exits = SessionMetrics::self()->counter("prts_session_child_exits_total",
+                                                           "Child processes that exited normally.", label);
+    MetricCounter *crashes = SessionMetrics::self()->counter("prts_session_child_crashes_total",
+                                                             "Child processes that crashed or were killed.", label);
+
+    connect(m_zygote, &ZygoteClient::finished, this, [this, exits, crashes](qint64 pid, int exitCode, bool crashed) {
+        const QString name = m_zygoteProcess.key(pid);
+        if (name.isEmpty())
+            return;
+
+        qDebug() << "Process finished:" << name << "Exit code:" << exitCode << "Crashed:" << crashed;
+        m_zygoteProcess.remove(name);
+        componentFinished(name, crashed);
+        if (crashed)
+            crashes->increment();
+        else
+            exits->increment();
+    });
+
+    // PR_SET_PDEATHSIG terminated the children along with the zygote. They are restarted
+    // as plain processes, isRunning() is false from now on.
+    connect(m_zygote, &ZygoteClient::lost, this, [this, crashes] {
+        const QMap<QString, qint64> children = m_zygoteProcess;
+        m_zygoteProcess.clear();
+
+        for (auto it = children.constBegin(); it != children.constEnd(); ++it) {
+            qWarning() << "Component lost with the zygote:" << it.key();
+            m_background.remove(it.value());
+            if (m_phase < ShuttingDown)
+                m_restartPending.insert(it.key());
+            componentFinished(it.key(), true);
+            crashes->increment();
+        }
+    });
+}
+
+void ProcessManager::spawnFromZygote(const SessionComponent &component)
+{
+    MetricHistogram *spawnLatency = SessionMetrics::self()->histogram("prts_session_spawn_latency_seconds",
+                                                                      "Time from starting a child process until it is running.",
+                                                                      SessionMetrics::label("kind", QStringLiteral("zygote")));
+    QElapsedTimer timer;
+    timer.start();
+
+    setComponentState(component.name, QStringLiteral("starting"));
+    const QString token = WindowTracker::newLaunchToken();
+    QProcessEnvironment environment = m_environment;
+    environment.insert(WindowTracker::launchTokenVariable(), token);
+    const quint32 request = m_zygote->spawn(component.zygoteModule,
+                                            QStringList() << component.program << component.arguments,
+                                            environment);
+
+    // Replies are matched by request id, the connections go away with the first one.
+    QObject *context = new QObject(this);
+    connect(m_zygote, &ZygoteClient::spawned, context, [this, context, component, request, token, spawnLatency, timer](quint32 id, qint64 pid) {
+        if (id != request)
+            return;
+        spawnLatency->observe(timer);
+        m_windows->track(pid, QStringLiteral("zygote"), component.name, QString(), token, timer);
+        m_zygoteProcess.insert(component.name, pid);
+        setComponentState(component.name, QStringLiteral("running"));
+        m_health->watch(component);
+        if (component.background)
+            m_background.add(pid);
+        qDebug() << "Load DE components from zygote: " << component.name << pid;
+        context->deleteLater();
+    });
+    connect(m_zygote, &ZygoteClient::failed, context, [this, context, component, request](quint32 id, const QString &error) {
+        if (id != request)
+            return;
+        qWarning() << "Failed to start process from zygote:" << component.name << error;
+        setComponentState(component.name, QStringLiteral("failed"));
+        context->deleteLater();
+    });
+}
+
+void ProcessManager::trackProcess(QProcess *process, const QString &kind)
+{
+    SessionMetrics *metrics = SessionMetrics::self();
+    const QByteArray label = SessionMetrics::label("kind", kind);
+    MetricHistogram *spawnLatency = metrics->histogram("prts_session_spawn_latency_seconds",
+                                                       "Time from starting a child process until it is running.",
+                                                       label);
+    MetricCounter *exits = metrics->counter("prts_session_child_exits_total",
+                                            "Child processes that exited normally.", label);
+    MetricCounter *crashes = metrics->counter("prts_session_child_crashes_total",
+                                              "Child processes that crashed or were killed.", label);
+    // Only system components are restarted, other kinds would export a series stuck at 0.
+    if (kind == QLatin1String("system"))
+        metrics->counter("prts_session_child_restarts_total", "Child processes restarted by the session.", label);
+
+    // Lets WindowTracker recognize the windows of processes that daemonized.
+    if (kind != QLatin1String("wm")) {
+        const QString token = WindowTracker::newLaunchToken();
+        QProcessEnvironment environment = process->processEnvironment();
+        if (environment.isEmpty())
+            environment = m_environment;
+        environment.insert(WindowTracker::launchTokenVariable(), token);
+        process->setProcessEnvironment(environment);
+        process->setProperty("launchToken", token);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    connect(process, &QProcess::started, this, [this, process, kind, spawnLatency, timer] {
+        spawnLatency->observe(timer);
+
+        if (kind == QLatin1String("wm"))
+            return;
+        const QString desktopId = process->property("desktopId").toString();
+        const QString name = desktopId.isEmpty() ? process->property("component").toString() : desktopId;
+        m_windows->track(process->processId(), kind, name, desktopId, process->property("launchToken").toString(), timer);
+    });
+    connect(process, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), this,
+            [exits, crashes](int, QProcess::ExitStatus exitStatus) {
+        if (exitStatus == QProcess::CrashExit)
+            crashes->increment();
+        else
+            exits->increment();
+    });
 }
@@ -4,31 +4,192 @@
 #include <QAbstractNativeEventFilter>
 #include <QObject>
 #include <QProcess>
-#include <QEventLoop>
 #include <QMap>
-#include <QWaylandClient>
+#include <QSet>
+#include <QProcessEnvironment>
+#include <QDataStream>
+
+#include "sessionmanifest.h"
+#include "displaysocket.h"
+#include "desktopfile.h"
+#include "backgroundgroup.h"
+
+class QSocketNotifier;
+class QTimer;
+class ActivationClaim;
+class AdmissionController;
+class AdoptedProcess;
+class AutostartHistory;
+class CacheWarmup;
+class HealthMonitor;
+class WindowTracker;
+class DesktopIndex;
+class PowerProfileHold;
+class ZygoteClient;
 
 class ProcessManager : public QObject
 {
     Q_OBJECT
 
 public:
+    /// Startup phases of the session, in the order they are reached.
+    enum Phase {
+        Initializing,
+        /// kwin registered org.kde.KWin, or did not within 30 s.
+        CompositorReady,
+        /// The compositor is ready and the manifest components were started.
+        ShellReady,
+        /// Every autostart entry but the deferrable ones was admitted and became ready.
+        Running,
+        ShuttingDown
+    };
+    Q_ENUM(Phase)
+
     explicit ProcessManager(QObject *parent = nullptr);
     ~ProcessManager();
 
+    Phase phase() const { return m_phase; }
+    static QString phaseName(Phase phase);
+    /// Returns the phase for a name returned by phaseName(), or -1.
+    static int phaseFromName(const QString &name);
+
+    /// Returns the state of every known component: waiting, starting, running, stopped or failed.
+    QMap<QString, QString> componentStates() const { return m_componentStates; }
+
     void start();
+    /// Stops the session with shutdown() and quits.
     void logout();
+    /*! Records the session for restore and stops every child process.
+        Only the first call does anything, the caller quits afterwards. */
+    void shutdown();
+
+    /*! Serializes the tracked processes and session state before a re-exec.
+        Children survive exec(), the new instance adopts them by PID in restoreState(). */
+    void saveState(QDataStream &out);
+    bool restoreState(QDataStream &in);
+
+    /*! Creates the Wayland listening socket that is later handed to the compositor.
+        Must be called before the environment is exported, see waylandDisplay(). */
+    bool createWaylandSocket();
+    /// Returns the WAYLAND_DISPLAY value clients should use, empty if the compositor picks its own.
+    QString waylandDisplay() const { return m_waylandSocket.name(); }
+
+    /*! Reserves an X11 display whose sockets are handed to the compositor,
+        which starts Xwayland on the first X11 connection. */
+    bool createX11Display();
+    /// Returns the DISPLAY value for X11 clients, empty if no display was reserved.
+    QString x11Display() const { return m_x11Socket.isValid() ? m_x11Socket.name() : QString(); }
+    QString xauthority() const { return m_x11Socket.xauthority(); }
+    /*! Whether an X11 client has connected, and Xwayland was therefore started.
+        Best-effort: noticed from the listening sockets or from Xwayland appearing as a child
+        of kwin, which is checked every few seconds and needs /proc/PID/task/TID/children. */
+    bool isX11Active() const { return m_x11Active; }
+
+    /// Called for every toplevel window the compositor maps, see WindowTracker.
+    void windowShown(const QString &sender, qint64 pid, const QString &desktopFileName);
+
+    bool isOnBattery() const { return m_onBattery; }
+    /// Switches between the AC and battery scheduling profiles of the manifest.
+    void setOnBattery(bool onBattery);
+
+    /// Sets the environment used for every process started by the session.
+    void setEnvironment(const QProcessEnvironment &environment);
 
     void startWindowManager();
+    /*! Builds the kwin_wayland command line that hands over the Wayland socket and,
+        when given, the X11 display sockets and Xauthority file for Xwayland. */
+    static QStringList windowManagerArguments(const QString &waylandName, int waylandFd,
+                                              const QString &x11Display, const QList<int> &x11Fds,
+                                              const QString &xauthority);
     void loadSystemProcess();
     void loadAutoStartProcess();
 
+    /*! Reads the .desktop files of the autostart directories, keyed by file name.
+        Directories come in priority order, an entry hides those of the same name in later ones. */
+    static QMap<QString, DesktopFile> readAutoStartEntries(const QStringList &dirs);
+
+    /*! Starts the application with the given desktop ID from the event loop,
+        so callers can connect to the returned process first.
+        Returns nullptr if the desktop ID is unknown, Hidden, or its TryExec program is missing. */
+    QProcess *launch(const QString &desktopId, const QStringList &urls = QStringList());
+
+signals:
+    void phaseChanged(ProcessManager::Phase phase);
+    void componentStateChanged(const QString &component, const QString &state);
+    void x11ActiveChanged(bool active);
+
+private:
+    struct AdoptedEntry {
+        QString kind;
+        QString name;
+        qint64 pid;
+    };
+
+    void setPhase(Phase phase);
+    void compositorReady();
+    void startShell();
+    void autostartDrained();
+    void setComponentState(const QString &component, const QString &state);
+    void trackProcess(QProcess *process, const QString &kind);
+    void startZygote();
+    void watchZygote();
+    void watchX11Display();
+    void setX11Active();
+    qint64 windowManagerPid() const;
+    static bool hasXwaylandChild(qint64 pid);
+    void adoptProcess(const AdoptedEntry &entry);
+    void spawnFromZygote(const SessionComponent &component);
+    void startComponent(const SessionComponent &component);
+    ActivationClaim *addActivation(const SessionComponent &component);
+    bool claimActivation(const SessionComponent &component);
+    void componentFinished(const QString &name, bool crashed);
+    void restartComponent(const QString &name);
+    void applySchedulingProfile();
+    void startAutoStartEntry(const QString &desktopId, const DesktopFile &entry);
+    /*! Records the running on-demand components and launched applications at logout,
+        leaving out applications whose desktop entry sets X-PRTS-Restore=false. */
+    void saveSession();
+    /*! Relaunches what saveSession() recorded once the shell is ready, queued behind the
+        autostart entries as background admission requests. */
+    void restoreSession();
+
 private:
     QMap<QString, QProcess *> m_systemProcess;
     QMap<QString, QProcess *> m_autoStartProcess;
+    QList<QProcess *> m_launchedProcess;
+    QMap<QString, qint64> m_zygoteProcess;
+    QList<AdoptedProcess *> m_adoptedProcess;
+    QProcess *m_wmProcess;
+
+    SessionManifest m_manifest;
+    WaylandSocket m_waylandSocket;
+    X11DisplaySocket m_x11Socket;
+    QList<QSocketNotifier *> m_x11Notifiers;
+    QTimer *m_x11Poll;
+    DesktopIndex *m_desktopIndex;
+    AutostartHistory *m_autostartHistory;
+    AdmissionController *m_admission;
+    HealthMonitor *m_health;
+    CacheWarmup *m_cacheWarmup;
+    WindowTracker *m_windows;
+    BackgroundGroup m_background;
+    QSet<QString> m_restartPending;
+    /// Every autostart entry queued at login, restore leaves them to autostart.
+    QSet<QString> m_autostartEntries;
+    /// Autostart entries that DeferAutostart of the scheduling profile applies to.
+    QSet<QString> m_profileDeferred;
+    QMap<QString, ActivationClaim *> m_activation;
+    ZygoteClient *m_zygote;
+    PowerProfileHold *m_profileHold;
+    QProcessEnvironment m_environment;
+
+    Phase m_phase;
+    QMap<QString, QString> m_componentStates;
+    bool m_x11Active;
+    bool m_onBattery;
 
     bool m_wmStarted;
-    QEventLoop *m_waitLoop;
+    bool m_shellStarted;
 };
 
 #endif // PROCESSMANAGER_H
@@ -0,0 +1,80 @@
+#include "sessionenvironment.h"
+
+#include <QStringList>
+#include <QDir>
+
+static void insertDefault(QProcessEnvironment &environment, const QString &name, const QString &value)
+{
+    if (environment.value(name).isEmpty())
+        environment.insert(name, value);
+}
+
+void SessionEnvironment::addDefaults(QProcessEnvironment &environment)
+{
+    // Set defaults
+    insertDefault(environment, QStringLiteral("XDG_DATA_HOME"), QDir::home().absoluteFilePath(QStringLiteral(".local/share")));
+    insertDefault(environment, QStringLiteral("XDG_DESKTOP_DIR"), QDir::home().absoluteFilePath(QStringLiteral("/Desktop")));
+    insertDefault(environment, QStringLiteral("XDG_CONFIG_HOME"), QDir::home().absoluteFilePath(QStringLiteral(".config")));
+    insertDefault(environment, QStringLiteral("XDG_CACHE_HOME"), QDir::home().absoluteFilePath(QStringLiteral(".cache")));
+    insertDefault(environment, QStringLiteral("XDG_DATA_DIRS"), QStringLiteral("/usr/local/share/:/usr/share/"));
+    insertDefault(environment, QStringLiteral("XDG_CONFIG_DIRS"), QStringLiteral("/etc/xdg"));
+
+    // Environment
+    environment.insert(QStringLiteral("DESKTOP_SESSION"), QStringLiteral("PRTS"));
+    environment.insert(QStringLiteral("XDG_CURRENT_DESKTOP"), QStringLiteral("PRTS"));
+    environment.insert(QStringLiteral("XDG_SESSION_DESKTOP"), QStringLiteral("PRTS"));
+    environment.insert(QStringLiteral("XDG_SESSION_TYPE"), QStringLiteral("wayland"));
+
+    // Qt
+    environment.insert(QStringLiteral("QT_QPA_PLATFORM"), QStringLiteral("wayland"));
+    environment.insert(QStringLiteral("QT_QPA_PLATFORMTHEME"), QStringLiteral("prts"));
+    environment.insert(QStringLiteral("QT_PLATFORM_PLUGIN"), QStringLiteral("wayland"));
+
+    environment.remove(QStringLiteral("QT_AUTO_SCREEN_SCALE_FACTOR"));
+    environment.remove(QStringLiteral("QT_SCALE_FACTOR"));
+    environment.remove(QStringLiteral("QT_SCREEN_SCALE_FACTORS"));
+    environment.remove(QStringLiteral("QT_ENABLE_HIGHDPI_SCALING"));
+    environment.remove(QStringLiteral("QT_USE_PHYSICAL_DPI"));
+    environment.remove(QStringLiteral("QT_FONT_DPI"));
+    environment.insert(QStringLiteral("QT_SCALE_FACTOR_ROUNDING_POLICY"), QStringLiteral("PassThrough"));
+
+    // IM Config
+    environment.insert(QStringLiteral("GTK_IM_MODULE"), QStringLiteral("fcitx5"));
+    environment.insert(QStringLiteral("QT4_IM_MODULE"), QStringLiteral("fcitx5"));
+    environment.insert(QStringLiteral("QT_IM_MODULE"), QStringLiteral("fcitx5"));
+    environment.insert(QStringLiteral("CLUTTER_IM_MODULE"), QStringLiteral("fcitx5"));
+    environment.insert(QStringLiteral("XMODIFIERS"), QStringLiteral("@im=fcitx"));
+}
+
+void SessionEnvironment::addLanguage(QProcessEnvironment &environment, const QString &language)
+{
+    const QString locale = QStringLiteral("%1.UTF-8").arg(language);
+
+    static const char *const lcValues[] = {
+        "LANG", "LC_NUMERIC", "LC_TIME", "LC_MONETARY", "LC_MEASUREMENT", "LC_COLLATE", "LC_CTYPE"
+    };
+
+    for (const char *lc : lcValues)
+        environment.insert(QLatin1String(lc), locale);
+
+    if (!language.isEmpty())
+        environment.insert(QStringLiteral("LANGUAGE"), language);
+}
+
+void SessionEnvironment::apply(const QProcessEnvironment &environment)
+{
+    const QProcessEnvironment current = QProcessEnvironment::systemEnvironment();
+
+    const QStringList currentKeys = current.keys();
+    for (const QString &key : currentKeys) {
+        if (!environment.contains(key))
+            qunsetenv(key.toLocal8Bit().constData());
+    }
+
+    const QStringList keys = environment.keys();
+    for (const QString &key : keys) {
+        const QString value = environment.value(key);
+        if (!current.contains(key) || current.value(key) != value)
+            qputenv(key.toLocal8Bit().constData(), value.toLocal8Bit());
+    }
+}
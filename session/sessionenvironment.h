@@ -0,0 +1,23 @@
+#ifndef SESSIONENVIRONMENT_H
+#define SESSIONENVIRONMENT_H
+
+#include <QProcessEnvironment>
+#include <QString>
+
+/*! Builds the environment every session child inherits.
+    The functions work on a copy so they can run without touching the session's own environment,
+    apply() exports the result.
+*/
+class SessionEnvironment
+{
+public:
+    /// Adds the XDG defaults and the desktop, Qt and input method variables.
+    static void addDefaults(QProcessEnvironment &environment);
+    /// Sets LANG, LANGUAGE and the LC_* variables for a language such as "en_US".
+    static void addLanguage(QProcessEnvironment &environment, const QString &language);
+
+    /// Makes environment the environment of the session process, setting and unsetting variables.
+    static void apply(const QProcessEnvironment &environment);
+};
+
+#endif // SESSIONENVIRONMENT_H
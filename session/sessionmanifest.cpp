@@ -0,0 +1,116 @@
+#include "sessionmanifest.h"
+#include "desktopfile.h"
+
+#include <QStandardPaths>
+#include <QDebug>
+
+static const QLatin1String componentPrefix("Component ");
+static const QLatin1String acProfileGroup("Profile AC");
+static const QLatin1String batteryProfileGroup("Profile Battery");
+
+SessionManifest::SessionManifest()
+{
+    m_batteryProfile.deferAutostart = true;
+    m_batteryProfile.backgroundCpuWeight = 20;
+    m_batteryProfile.cacheWarmup = false;
+}
+
+SessionManifest SessionManifest::load()
+{
+    SessionManifest manifest;
+
+    // Highest priority first, so the user's manifest is merged before the system one.
+    const QStringList files = QStandardPaths::locateAll(QStandardPaths::GenericConfigLocation,
+                                                        QStringLiteral("PRTS/session.manifest"));
+    for (const QString &path : files)
+        manifest.merge(DesktopFile::fromFile(path));
+
+    // Profiles are merged key by key, lowest priority first.
+    for (auto it = files.crbegin(); it != files.crend(); ++it) {
+        const DesktopFile file = DesktopFile::fromFile(*it);
+        manifest.mergeProfile(file, acProfileGroup, manifest.m_acProfile);
+        manifest.mergeProfile(file, batteryProfileGroup, manifest.m_batteryProfile);
+    }
+
+    if (files.isEmpty()) {
+        SessionComponent firefox;
+        firefox.name = QStringLiteral("firefox");
+        firefox.program = QStringLiteral("/usr/bin/firefox");
+        manifest.m_components << firefox;
+    }
+
+    return manifest;
+}
+
+void SessionManifest::merge(const DesktopFile &file)
+{
+    const QStringList groups = file.groups();
+    for (const QString &group : groups) {
+        if (!group.startsWith(componentPrefix))
+            continue;
+
+        const QString name = group.mid(componentPrefix.size()).trimmed();
+        if (name.isEmpty() || m_seen.contains(name))
+            continue;
+        m_seen << name;
+
+        if (file.boolValue(QStringLiteral("Hidden"), false, group))
+            continue;
+
+        QStringList args = DesktopFile::splitExec(file.value(QStringLiteral("Exec"), group));
+        if (args.isEmpty()) {
+            qWarning() << "Session component without Exec:" << name << file.fileName();
+            continue;
+        }
+
+        SessionComponent component;
+        component.name = name;
+        component.program = args.takeFirst();
+        component.arguments = args;
+        component.zygoteModule = file.value(QStringLiteral("ZygoteModule"), group);
+
+        component.background = file.boolValue(QStringLiteral("Background"), false, group);
+
+        component.activation = file.value(QStringLiteral("Activation"), group);
+        if (!component.activation.isEmpty() && !component.activation.startsWith(QLatin1String("dbus:"))
+                && !component.activation.startsWith(QLatin1String("socket:"))) {
+            qWarning() << "Ignoring unknown activation" << component.activation << "of" << name;
+            component.activation.clear();
+        }
+
+        component.probe = file.value(QStringLiteral("Probe"), group);
+        if (!component.probe.isEmpty() && !component.probe.startsWith(QLatin1String("dbus:"))
+                && !component.probe.startsWith(QLatin1String("socket:"))) {
+            qWarning() << "Ignoring unknown probe" << component.probe << "of" << name;
+            component.probe.clear();
+        }
+        if (component.probe.startsWith(QLatin1String("dbus:")) && component.probe.indexOf(QLatin1Char('/')) < 0) {
+            qWarning() << "Ignoring probe" << component.probe << "of" << name << "without an object path";
+            component.probe.clear();
+        }
+        component.probeInterval = file.value(QStringLiteral("ProbeInterval"), group).toInt();
+        component.probeTimeout = file.value(QStringLiteral("ProbeTimeout"), group).toInt();
+        component.probeFailures = file.value(QStringLiteral("ProbeFailures"), group).toInt();
+        if (component.probeInterval <= 0)
+            component.probeInterval = SessionComponent().probeInterval;
+        if (component.probeTimeout <= 0)
+            component.probeTimeout = SessionComponent().probeTimeout;
+        if (component.probeFailures <= 0)
+            component.probeFailures = SessionComponent().probeFailures;
+        m_components << component;
+    }
+}
+
+void SessionManifest::mergeProfile(const DesktopFile &file, const QString &group, SchedulingProfile &profile)
+{
+    if (!file.groups().contains(group))
+        return;
+
+    profile.deferAutostart = file.boolValue(QStringLiteral("DeferAutostart"), profile.deferAutostart, group);
+    profile.cacheWarmup = file.boolValue(QStringLiteral("CacheWarmup"), profile.cacheWarmup, group);
+
+    bool ok = false;
+    const int weight = file.value(QStringLiteral("BackgroundCpuWeight"), group).toInt(&ok);
+    if (ok)
+        profile.backgroundCpuWeight = qBound(1, weight, 10000);
+}
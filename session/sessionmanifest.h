@@ -0,0 +1,69 @@
+#ifndef SESSIONMANIFEST_H
+#define SESSIONMANIFEST_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+class DesktopFile;
+
+/*! A long-running shell component started by the session at login. */
+struct SessionComponent
+{
+    QString name;
+    QString program;
+    QStringList arguments;
+
+    /// Shared library with a prts_zygote_main() entry point, started from the zygote when set.
+    QString zygoteModule;
+
+    /// Liveness probe, "dbus:<well-known name><object path>" or "socket:<path>", none when empty.
+    QString probe;
+    int probeInterval = 10 * 1000;
+    int probeTimeout = 2 * 1000;
+    /// Consecutive failed probes after which the component is restarted.
+    int probeFailures = 3;
+
+    /// Runs with the background CPU weight of the current scheduling profile.
+    bool background = false;
+
+    /*! Starts on first use instead of at login: "dbus:<well-known name>" or "socket:<path>".
+        The session holds the name or socket until then, see ActivationClaim. */
+    QString activation;
+};
+
+/*! How the session schedules work on AC power or on battery, see [Profile AC] and [Profile Battery]. */
+struct SchedulingProfile
+{
+    /// Autostart entries not marked X-PRTS-Essential start on at most half of the admission slots.
+    bool deferAutostart = false;
+    /// cgroup cpu.weight of autostart entries and background components, 100 is the kernel default.
+    int backgroundCpuWeight = 100;
+    /// Whether caches are checked and read ahead at login.
+    bool cacheWarmup = true;
+};
+
+/*! Components declared in PRTS/session.manifest under the XDG config directories.
+    Each component is a [Component <name>] group, a group in the user's
+    manifest replaces the group of the same name from the system one.
+*/
+class SessionManifest
+{
+public:
+    SessionManifest();
+    static SessionManifest load();
+
+    QList<SessionComponent> components() const { return m_components; }
+    SchedulingProfile profile(bool onBattery) const { return onBattery ? m_batteryProfile : m_acProfile; }
+
+private:
+    void merge(const DesktopFile &file);
+    void mergeProfile(const DesktopFile &file, const QString &group, SchedulingProfile &profile);
+
+    QList<SessionComponent> m_components;
+    QStringList m_seen;
+    SchedulingProfile m_acProfile;
+    SchedulingProfile m_batteryProfile;
+};
+
+#endif // SESSIONMANIFEST_H
@@ -0,0 +1,232 @@
+#include "sessionmetrics.h"
+
+#include <QStandardPaths>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QTimer>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+
+#include <time.h>
+#include <unistd.h>
+
+// Tick interval of the event loop monitor and the lateness that counts as a stall.
+// Once a second is enough to catch stalls without keeping the session awake.
+static const int monitorInterval = 1000;
+static const int stallThreshold = 250;
+// A coarse timer may fire up to 5% of its interval late without the loop being blocked.
+static const int coarseSlack = monitorInterval / 20;
+
+void MetricHistogram::observe(qint64 nsecs)
+{
+    const double seconds = nsecs / 1e9;
+
+    size_t index = 0;
+    while (index < Bounds.size() && seconds > Bounds[index])
+        ++index;
+
+    m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sumNsecs.fetch_add(quint64(qMax<qint64>(nsecs, 0)), std::memory_order_relaxed);
+}
+
+SessionMetrics *SessionMetrics::self()
+{
+    static SessionMetrics s_self;
+    return &s_self;
+}
+
+SessionMetrics::Family &SessionMetrics::family(const char *name, const char *help, Type type)
+{
+    auto it = m_families.find(QByteArray(name));
+    if (it == m_families.end()) {
+        it = m_families.emplace(QByteArray(name), Family()).first;
+        it->second.type = type;
+        it->second.help = help;
+    }
+
+    Q_ASSERT(it->second.type == type);
+    return it->second;
+}
+
+MetricCounter *SessionMetrics::counter(const char *name, const char *help, const QByteArray &labels)
+{
+    QMutexLocker locker(&m_mutex);
+    std::unique_ptr<MetricCounter> &counter = family(name, help, Counter).counters[labels];
+    if (!counter)
+        counter.reset(new MetricCounter);
+    return counter.get();
+}
+
+MetricHistogram *SessionMetrics::histogram(const char *name, const char *help, const QByteArray &labels)
+{
+    QMutexLocker locker(&m_mutex);
+    std::unique_ptr<MetricHistogram> &histogram = family(name, help, Histogram).histograms[labels];
+    if (!histogram)
+        histogram.reset(new MetricHistogram);
+    return histogram.get();
+}
+
+MetricGauge *SessionMetrics::gauge(const char *name, const char *help, const QByteArray &labels)
+{
+    QMutexLocker locker(&m_mutex);
+    std::unique_ptr<MetricGauge> &gauge = family(name, help, Gauge).gauges[labels];
+    if (!gauge)
+        gauge.reset(new MetricGauge);
+    return gauge.get();
+}
+
+void SessionMetrics::recordStartup()
+{
+    QFile file(QStringLiteral("/proc/self/stat"));
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    // The command name may contain spaces, fields are counted after its closing parenthesis.
+    const QByteArray stat = file.readAll();
+    const QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 20)
+        return;
+
+    // Field 22, the start time in clock ticks since boot.
+    const double started = fields.at(19).toULongLong() / double(sysconf(_SC_CLK_TCK));
+
+    timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+
+    gauge("prts_session_startup_seconds", "Time from process creation until the event loop started.")
+            ->set(now.tv_sec + now.tv_nsec / 1e9 - started);
+}
+
+void SessionMetrics::updateProcessGauges()
+{
+    QFile file(QStringLiteral("/proc/self/statm"));
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    const QList<QByteArray> fields = file.readAll().split(' ');
+    if (fields.size() < 2)
+        return;
+
+    gauge("prts_session_resident_memory_bytes", "Resident set size of the session process.")
+            ->set(fields.at(1).toDouble() * sysconf(_SC_PAGESIZE));
+}
+
+QByteArray SessionMetrics::label(const char *key, const QString &value)
+{
+    QByteArray escaped = value.toUtf8();
+    escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    return QByteArray(key) + "=\"" + escaped + '"';
+}
+
+static QByteArray joinLabels(const QByteArray &labels, const QByteArray &extra)
+{
+    if (labels.isEmpty() && extra.isEmpty())
+        return QByteArray();
+    if (labels.isEmpty())
+        return '{' + extra + '}';
+    if (extra.isEmpty())
+        return '{' + labels + '}';
+    return '{' + labels + ',' + extra + '}';
+}
+
+QByteArray SessionMetrics::exposition()
+{
+    updateProcessGauges();
+
+    QMutexLocker locker(&m_mutex);
+    QByteArray out;
+    out.reserve(4096);
+
+    for (const auto &entry : m_families) {
+        const QByteArray &name = entry.first;
+        const Family &family = entry.second;
+
+        out += "# HELP " + name + ' ' + family.help + '\n';
+        out += "# TYPE " + name
+             + (family.type == Counter ? " counter\n" : family.type == Gauge ? " gauge\n" : " histogram\n");
+
+        for (const auto &counter : family.counters) {
+            out += name + joinLabels(counter.first, QByteArray()) + ' '
+                 + QByteArray::number(counter.second->value()) + '\n';
+        }
+
+        for (const auto &gauge : family.gauges) {
+            out += name + joinLabels(gauge.first, QByteArray()) + ' '
+                 + QByteArray::number(gauge.second->value(), 'g', 9) + '\n';
+        }
+
+        for (const auto &histogram : family.histograms) {
+            const MetricHistogram *h = histogram.second.get();
+            quint64 cumulative = 0;
+
+            for (size_t i = 0; i <= MetricHistogram::Bounds.size(); ++i) {
+                cumulative += h->bucket(int(i));
+                const QByteArray le = i < MetricHistogram::Bounds.size()
+                        ? QByteArray::number(MetricHistogram::Bounds[i], 'g', 6)
+                        : QByteArray("+Inf");
+                out += name + "_bucket" + joinLabels(histogram.first, "le=\"" + le + '"') + ' '
+                     + QByteArray::number(cumulative) + '\n';
+            }
+
+            out += name + "_sum" + joinLabels(histogram.first, QByteArray()) + ' '
+                 + QByteArray::number(h->sum(), 'g', 9) + '\n';
+            out += name + "_count" + joinLabels(histogram.first, QByteArray()) + ' '
+                 + QByteArray::number(h->count()) + '\n';
+        }
+    }
+
+    return out;
+}
+
+QString SessionMetrics::writeExposition()
+{
+    const QString runtimeDir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (runtimeDir.isEmpty())
+        return QString();
+
+    const QString dir = runtimeDir + QStringLiteral("/prts-session");
+    if (!QDir().mkpath(dir)) {
+        qWarning() << "Could not create metrics directory" << dir;
+        return QString();
+    }
+
+    QSaveFile file(dir + QStringLiteral("/metrics.prom"));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write metrics" << file.fileName() << file.errorString();
+        return QString();
+    }
+
+    file.write(exposition());
+    if (!file.commit())
+        return QString();
+
+    return file.fileName();
+}
+
+EventLoopMonitor::EventLoopMonitor(QObject *parent)
+    : QObject(parent)
+    , m_timer(new QTimer(this))
+    , m_stalls(SessionMetrics::self()->counter("prts_session_event_loop_stalls_total",
+                                               "Event loop iterations delayed by more than 250 ms."))
+    , m_lag(SessionMetrics::self()->histogram("prts_session_event_loop_lag_seconds",
+                                              "Delay of the event loop monitor tick beyond its interval."))
+{
+    m_timer->setTimerType(Qt::CoarseTimer);
+    m_timer->setInterval(monitorInterval);
+    connect(m_timer, &QTimer::timeout, this, &EventLoopMonitor::tick);
+    m_timer->start();
+    m_lastTick.start();
+}
+
+void EventLoopMonitor::tick()
+{
+    const qint64 lag = m_lastTick.restart() - monitorInterval - coarseSlack;
+    if (lag <= 0)
+        return;
+
+    m_lag->observe(lag * 1000000);
+    if (lag > stallThreshold)
+        m_stalls->increment();
+}
@@ -0,0 +1,125 @@
+#ifndef SESSIONMETRICS_H
+#define SESSIONMETRICS_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+
+class QTimer;
+
+/*! Monotonic counter, safe to bump from any thread. */
+class MetricCounter
+{
+public:
+    void increment(quint64 value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+    quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value { 0 };
+};
+
+/*! Value that can go up and down. */
+class MetricGauge
+{
+public:
+    void set(double value) { m_value.store(value, std::memory_order_relaxed); }
+    double value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> m_value { 0 };
+};
+
+/*! Fixed-bucket latency histogram. Bounds are in seconds, the last bucket is +Inf. */
+class MetricHistogram
+{
+public:
+    static constexpr std::array<double, 12> Bounds = {
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 10.0
+    };
+
+    void observe(qint64 nsecs);
+    void observe(const QElapsedTimer &timer) { observe(timer.nsecsElapsed()); }
+
+    quint64 bucket(int index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    double sum() const { return m_sumNsecs.load(std::memory_order_relaxed) / 1e9; }
+
+private:
+    std::array<std::atomic<quint64>, Bounds.size() + 1> m_buckets {};
+    std::atomic<quint64> m_count { 0 };
+    std::atomic<quint64> m_sumNsecs { 0 };
+};
+
+/*! Process-wide registry of session metrics.
+    Lookups take a lock, so hot paths should keep the returned pointer around.
+    Metrics are never removed, pointers stay valid for the lifetime of the process.
+*/
+class SessionMetrics
+{
+public:
+    static SessionMetrics *self();
+
+    MetricCounter *counter(const char *name, const char *help, const QByteArray &labels = QByteArray());
+    MetricHistogram *histogram(const char *name, const char *help, const QByteArray &labels = QByteArray());
+    MetricGauge *gauge(const char *name, const char *help, const QByteArray &labels = QByteArray());
+
+    /// Records the time from process creation until now, call it once the event loop runs.
+    void recordStartup();
+
+    /// Formats a single label pair, e.g. kind="autostart".
+    static QByteArray label(const char *key, const QString &value);
+
+    /// Returns all metrics in the Prometheus text exposition format.
+    QByteArray exposition();
+
+    /// Writes exposition() to $XDG_RUNTIME_DIR/prts-session/metrics.prom, returns the path or an empty string.
+    QString writeExposition();
+
+private:
+    enum Type {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    struct Family {
+        Type type;
+        QByteArray help;
+        std::map<QByteArray, std::unique_ptr<MetricCounter>> counters;
+        std::map<QByteArray, std::unique_ptr<MetricGauge>> gauges;
+        std::map<QByteArray, std::unique_ptr<MetricHistogram>> histograms;
+    };
+
+    Family &family(const char *name, const char *help, Type type);
+    void updateProcessGauges();
+
+    mutable QMutex m_mutex;
+    std::map<QByteArray, Family> m_families;
+};
+
+/*! Counts event loop stalls: ticks of a once a second timer that arrive much later than scheduled. */
+class EventLoopMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit EventLoopMonitor(QObject *parent = nullptr);
+
+private slots:
+    void tick();
+
+private:
+    QTimer *m_timer;
+    QElapsedTimer m_lastTick;
+    MetricCounter *m_stalls;
+    MetricHistogram *m_lag;
+};
+
+#endif // SESSIONMETRICS_H
@@ -0,0 +1,73 @@
+#include "sessionrestore.h"
+
+#include <QDataStream>
+#include <QSaveFile>
+#include <QSettings>
+#include <QFileInfo>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+
+static const QByteArray restoreMagic("PRTS-RESTORE");
+static const quint32 restoreVersion = 1;
+
+QString SessionRestore::fileName()
+{
+    QString stateHome = qEnvironmentVariable("XDG_STATE_HOME");
+    if (stateHome.isEmpty())
+        stateHome = QDir::home().absoluteFilePath(QStringLiteral(".local/state"));
+    return stateHome + QStringLiteral("/prts-session/restore");
+}
+
+bool SessionRestore::isEnabled()
+{
+    QSettings settings(QSettings::UserScope, "PRTS", "session");
+    settings.beginGroup("Restore");
+    return settings.value("Enabled", true).toBool();
+}
+
+bool SessionRestore::load()
+{
+    QFile file(fileName());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    QByteArray magic;
+    quint32 version;
+    QStringList components;
+    QStringList applications;
+    in >> magic >> version;
+
+    if (magic != restoreMagic || version != restoreVersion) {
+        qWarning() << "Ignoring incompatible session restore record" << file.fileName();
+        return false;
+    }
+
+    in >> components >> applications;
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Ignoring truncated session restore record" << file.fileName();
+        return false;
+    }
+
+    m_components = components;
+    m_applications = applications;
+    return true;
+}
+
+void SessionRestore::save() const
+{
+    const QString path = fileName();
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write session restore record" << path << file.errorString();
+        return;
+    }
+
+    QDataStream out(&file);
+    out << restoreMagic << restoreVersion << m_components << m_applications;
+    file.commit();
+}
@@ -0,0 +1,34 @@
+#ifndef SESSIONRESTORE_H
+#define SESSIONRESTORE_H
+
+#include <QStringList>
+
+/*! What was running at logout, relaunched at the next login after the shell is ready.
+    Only on-demand components and applications launched through the session are recorded,
+    everything else is started at login anyway.
+*/
+class SessionRestore
+{
+public:
+    /// $XDG_STATE_HOME/prts-session/restore
+    static QString fileName();
+    /// [Restore] Enabled= in the session settings, true by default.
+    static bool isEnabled();
+
+    bool load();
+    void save() const;
+
+    /// Names of on-demand components that were in use.
+    QStringList components() const { return m_components; }
+    void setComponents(const QStringList &components) { m_components = components; }
+
+    /// Desktop IDs of launched applications, in launch order.
+    QStringList applications() const { return m_applications; }
+    void setApplications(const QStringList &applications) { m_applications = applications; }
+
+private:
+    QStringList m_components;
+    QStringList m_applications;
+};
+
+#endif // SESSIONRESTORE_H
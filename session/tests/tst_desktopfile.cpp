@@ -0,0 +1,107 @@
+#include "desktopfile.h"
+
+#include <QTest>
+
+/*! Exec lines go through the key file unescaping first and the Exec quoting rules second,
+    the data below is written the way it appears in a .desktop file. */
+class DesktopFileTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static DesktopFile entry(const QByteArray &lines)
+    {
+        return DesktopFile::fromData("[Desktop Entry]\nType=Application\nName=Editor\n" + lines,
+                                     QStringLiteral("/usr/share/applications/editor.desktop"));
+    }
+
+private slots:
+    void execArguments_data()
+    {
+        QTest::addColumn<QByteArray>("exec");
+        QTest::addColumn<QStringList>("urls");
+        QTest::addColumn<QStringList>("expected");
+
+        const QStringList files = { QStringLiteral("file:///tmp/a.txt"), QStringLiteral("file:///tmp/b%20c.txt") };
+
+        QTest::newRow("plain") << QByteArray("Exec=editor --new-window") << QStringList()
+                               << QStringList({ QStringLiteral("editor"), QStringLiteral("--new-window") });
+        QTest::newRow("repeated whitespace") << QByteArray("Exec=editor   --new-window") << QStringList()
+                                             << QStringList({ QStringLiteral("editor"), QStringLiteral("--new-window") });
+        QTest::newRow("%f takes the first file") << QByteArray("Exec=editor %f") << files
+                                                 << QStringList({ QStringLiteral("editor"), QStringLiteral("/tmp/a.txt") });
+        QTest::newRow("%F takes every file") << QByteArray("Exec=editor %F") << files
+                                             << QStringList({ QStringLiteral("editor"), QStringLiteral("/tmp/a.txt"),
+                                                              QStringLiteral("/tmp/b c.txt") });
+        QTest::newRow("%f keeps remote urls") << QByteArray("Exec=editor %f")
+                                              << QStringList({ QStringLiteral("https://example.org/a.txt") })
+                                              << QStringList({ QStringLiteral("editor"), QStringLiteral("https://example.org/a.txt") });
+        QTest::newRow("%u takes the first url") << QByteArray("Exec=editor %u") << files
+                                                << QStringList({ QStringLiteral("editor"), QStringLiteral("file:///tmp/a.txt") });
+        QTest::newRow("%U takes every url") << QByteArray("Exec=editor %U") << files
+                                            << QStringList({ QStringLiteral("editor"), files.at(0), files.at(1) });
+        QTest::newRow("field codes without urls") << QByteArray("Exec=editor %f --new-window %U") << QStringList()
+                                                  << QStringList({ QStringLiteral("editor"), QStringLiteral("--new-window") });
+        QTest::newRow("field code inside an argument") << QByteArray("Exec=editor --open=%f") << files
+                                                       << QStringList({ QStringLiteral("editor"), QStringLiteral("--open=/tmp/a.txt") });
+        QTest::newRow("%%") << QByteArray("Exec=printf 100%%") << QStringList()
+                            << QStringList({ QStringLiteral("printf"), QStringLiteral("100%") });
+        QTest::newRow("%c and %k") << QByteArray("Exec=editor --caption %c --desktop-file %k") << QStringList()
+                                   << QStringList({ QStringLiteral("editor"), QStringLiteral("--caption"), QStringLiteral("Editor"),
+                                                    QStringLiteral("--desktop-file"),
+                                                    QStringLiteral("/usr/share/applications/editor.desktop") });
+        QTest::newRow("deprecated field codes") << QByteArray("Exec=editor %d %D %n %N %v %m") << QStringList()
+                                                << QStringList({ QStringLiteral("editor") });
+        QTest::newRow("%i without Icon") << QByteArray("Exec=editor %i") << QStringList()
+                                         << QStringList({ QStringLiteral("editor") });
+        QTest::newRow("%i with Icon") << QByteArray("Icon=accessories-text-editor\nExec=editor %i") << QStringList()
+                                      << QStringList({ QStringLiteral("editor"), QStringLiteral("--icon"),
+                                                       QStringLiteral("accessories-text-editor") });
+        QTest::newRow("quoted arguments") << QByteArray("Exec=\"/opt/My Editor/editor\" --title \"two words\"") << QStringList()
+                                          << QStringList({ QStringLiteral("/opt/My Editor/editor"), QStringLiteral("--title"),
+                                                           QStringLiteral("two words") });
+        QTest::newRow("empty quoted argument") << QByteArray("Exec=editor \"\"") << QStringList()
+                                               << QStringList({ QStringLiteral("editor"), QString() });
+        QTest::newRow("escaped quote inside quotes") << QByteArray("Exec=sh -c \"echo \\\\\"hi\\\\\"\"") << QStringList()
+                                                     << QStringList({ QStringLiteral("sh"), QStringLiteral("-c"),
+                                                                      QStringLiteral("echo \"hi\"") });
+        QTest::newRow("escaped space") << QByteArray("Exec=/opt/my\\\\ editor/run") << QStringList()
+                                       << QStringList({ QStringLiteral("/opt/my editor/run") });
+        QTest::newRow("\\s is a plain space") << QByteArray("Exec=editor\\s--new-window") << QStringList()
+                                              << QStringList({ QStringLiteral("editor"), QStringLiteral("--new-window") });
+        QTest::newRow("no Exec") << QByteArray() << QStringList() << QStringList();
+    }
+
+    void execArguments()
+    {
+        QFETCH(QByteArray, exec);
+        QFETCH(QStringList, urls);
+        QFETCH(QStringList, expected);
+
+        QCOMPARE(entry(exec + '\n').execArguments(urls), expected);
+    }
+
+    void isLaunchable_data()
+    {
+        QTest::addColumn<QByteArray>("lines");
+        QTest::addColumn<bool>("launchable");
+
+        QTest::newRow("plain") << QByteArray("Exec=sh\n") << true;
+        QTest::newRow("hidden") << QByteArray("Exec=sh\nHidden=true\n") << false;
+        QTest::newRow("TryExec in PATH") << QByteArray("Exec=sh\nTryExec=sh\n") << true;
+        QTest::newRow("TryExec absolute") << QByteArray("Exec=sh\nTryExec=/bin/sh\n") << true;
+        QTest::newRow("TryExec missing") << QByteArray("Exec=sh\nTryExec=prts-no-such-program\n") << false;
+        QTest::newRow("TryExec absolute missing") << QByteArray("Exec=sh\nTryExec=/nonexistent/prts\n") << false;
+    }
+
+    void isLaunchable()
+    {
+        QFETCH(QByteArray, lines);
+        QFETCH(bool, launchable);
+
+        QCOMPARE(entry(lines).isLaunchable(), launchable);
+    }
+};
+
+QTEST_GUILESS_MAIN(DesktopFileTest)
+#include "tst_desktopfile.moc"
@@ -0,0 +1,193 @@
+#include "powermanager/powerprofiles.h"
+
+#include <QDBusConnection>
+#include <QDBusContext>
+#include <QDBusMessage>
+#include <QDBusServer>
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTest>
+
+static const QString mockPath = QStringLiteral("/net/hadess/PowerProfiles");
+static const QString mockInterface = QStringLiteral("net.hadess.PowerProfiles");
+
+/*! Stands in for power-profiles-daemon on a peer-to-peer connection, so no bus is needed. */
+class MockPowerProfiles : public QObject, protected QDBusContext
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "net.hadess.PowerProfiles")
+
+public:
+    QStringList profiles;
+    QList<uint> released;
+    /// Holds the replies back, they are sent by replyPending().
+    bool delayReplies = false;
+
+    void replyPending()
+    {
+        for (const QDBusMessage &message : qAsConst(m_pending))
+            m_connection.send(message.createReply(QVariant::fromValue(m_nextCookie++)));
+        m_pending.clear();
+    }
+
+public slots:
+    uint HoldProfile(const QString &profile, const QString &reason, const QString &applicationId)
+    {
+        Q_UNUSED(reason)
+        Q_UNUSED(applicationId)
+        profiles << profile;
+
+        if (delayReplies) {
+            setDelayedReply(true);
+            m_connection = connection();
+            m_pending << message();
+            return 0;
+        }
+        return m_nextCookie++;
+    }
+
+    void ReleaseProfile(uint cookie)
+    {
+        released << cookie;
+    }
+
+private:
+    QDBusConnection m_connection = QDBusConnection(QString());
+    QList<QDBusMessage> m_pending;
+    uint m_nextCookie = 1;
+};
+
+class PowerProfileHoldTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    PowerProfileHold *createHold(QObject *parent = nullptr)
+    {
+        return new PowerProfileHold(m_client, QString(), mockPath, mockInterface, parent);
+    }
+
+private slots:
+    void init()
+    {
+        m_mock = new MockPowerProfiles;
+        m_server = new QDBusServer(QStringLiteral("unix:tmpdir=/tmp"));
+        QVERIFY(m_server->isConnected());
+
+        m_registered = false;
+        connect(m_server, &QDBusServer::newConnection, m_mock, [this](const QDBusConnection &connection) {
+            QDBusConnection server = connection;
+            m_registered = server.registerObject(mockPath, m_mock, QDBusConnection::ExportAllSlots);
+        });
+
+        m_client = QDBusConnection::connectToPeer(m_server->address(), QStringLiteral("power-profiles-client"));
+        QVERIFY(m_client.isConnected());
+        QTRY_VERIFY(m_registered);
+    }
+
+    void cleanup()
+    {
+        QDBusConnection::disconnectFromPeer(QStringLiteral("power-profiles-client"));
+        delete m_server;
+        delete m_mock;
+    }
+
+    void holdAndRelease()
+    {
+        PowerProfileHold *hold = createHold(this);
+        QSignalSpy held(hold, &PowerProfileHold::held);
+        QSignalSpy released(hold, &PowerProfileHold::released);
+
+        hold->hold(QStringLiteral("performance"), QStringLiteral("Session startup"), 60 * 1000);
+        QTRY_VERIFY(hold->isHeld());
+        QCOMPARE(held.count(), 1);
+        QCOMPARE(held.constFirst().constFirst().toString(), QStringLiteral("performance"));
+        QCOMPARE(m_mock->profiles, QStringList({ QStringLiteral("performance") }));
+
+        // A second hold while one is active is ignored.
+        hold->hold(QStringLiteral("power-saver"), QStringLiteral("Again"), 60 * 1000);
+
+        hold->release();
+        QVERIFY(!hold->isHeld());
+        QCOMPARE(released.count(), 1);
+        QTRY_COMPARE(m_mock->released, QList<uint>({ 1 }));
+        QCOMPARE(m_mock->profiles.size(), 1);
+
+        delete hold;
+    }
+
+    void releaseOnTimeout()
+    {
+        PowerProfileHold *hold = createHold(this);
+
+        hold->hold(QStringLiteral("performance"), QStringLiteral("Session startup"), 200);
+        QTRY_VERIFY(hold->isHeld());
+        QTRY_VERIFY(!hold->isHeld());
+        QTRY_COMPARE(m_mock->released, QList<uint>({ 1 }));
+
+        delete hold;
+    }
+
+    void releaseOnDestruction()
+    {
+        PowerProfileHold *hold = createHold();
+
+        hold->hold(QStringLiteral("performance"), QStringLiteral("Session startup"), 60 * 1000);
+        QTRY_VERIFY(hold->isHeld());
+
+        delete hold;
+        QTRY_COMPARE(m_mock->released, QList<uint>({ 1 }));
+    }
+
+    void releaseBeforeReply()
+    {
+        m_mock->delayReplies = true;
+        PowerProfileHold *hold = createHold(this);
+        QSignalSpy released(hold, &PowerProfileHold::released);
+
+        hold->hold(QStringLiteral("performance"), QStringLiteral("Session startup"), 60 * 1000);
+        QTRY_COMPARE(m_mock->profiles.size(), 1);
+        hold->release();
+        QVERIFY(!hold->isHeld());
+
+        // The late cookie is handed back right away.
+        m_mock->replyPending();
+        QTRY_COMPARE(m_mock->released, QList<uint>({ 1 }));
+        QVERIFY(!hold->isHeld());
+        QCOMPARE(released.count(), 1);
+
+        delete hold;
+    }
+
+    void unavailableDaemon()
+    {
+        // Nothing listens on the address, every call fails without waiting for a timeout.
+        QDBusConnection unavailable = QDBusConnection::connectToPeer(
+                    QStringLiteral("unix:path=/nonexistent/prts-power-profiles"), QStringLiteral("power-profiles-unavailable"));
+        QVERIFY(!unavailable.isConnected());
+
+        PowerProfileHold *hold = new PowerProfileHold(unavailable, QString(), mockPath, mockInterface, this);
+        QSignalSpy held(hold, &PowerProfileHold::held);
+
+        QElapsedTimer timer;
+        timer.start();
+        hold->hold(QStringLiteral("performance"), QStringLiteral("Session startup"), 60 * 1000);
+        QVERIFY(timer.elapsed() < 1000);
+
+        QTest::qWait(100);
+        QVERIFY(!hold->isHeld());
+        QCOMPARE(held.count(), 0);
+
+        delete hold;
+        QDBusConnection::disconnectFromPeer(QStringLiteral("power-profiles-unavailable"));
+    }
+
+private:
+    MockPowerProfiles *m_mock = nullptr;
+    QDBusServer *m_server = nullptr;
+    QDBusConnection m_client = QDBusConnection(QString());
+    bool m_registered = false;
+};
+
+QTEST_GUILESS_MAIN(PowerProfileHoldTest)
+#include "tst_powerprofilehold.moc"
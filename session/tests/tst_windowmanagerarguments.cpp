@@ -0,0 +1,58 @@
+#include "processmanager.h"
+
+#include <QTest>
+
+/*! kwin_wayland rejects unknown options and exits, so the command line has to match its options exactly. */
+class WindowManagerArgumentsTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void waylandOnly()
+    {
+        const QStringList arguments = ProcessManager::windowManagerArguments(
+                    QStringLiteral("wayland-1"), 7, QString(), QList<int>(), QString());
+
+        QCOMPARE(arguments, QStringList({
+            QStringLiteral("--wayland-fd"), QStringLiteral("7"),
+            QStringLiteral("--socket"), QStringLiteral("wayland-1"),
+        }));
+    }
+
+    void waylandAndXwayland()
+    {
+        const QStringList arguments = ProcessManager::windowManagerArguments(
+                    QStringLiteral("wayland-0"), 9, QStringLiteral(":1"), QList<int>({ 10, 11 }),
+                    QStringLiteral("/run/user/1000/prts-session-xauth-1"));
+
+        QCOMPARE(arguments, QStringList({
+            QStringLiteral("--xwayland"),
+            QStringLiteral("--xwayland-display"), QStringLiteral(":1"),
+            QStringLiteral("--xwayland-xauthority"), QStringLiteral("/run/user/1000/prts-session-xauth-1"),
+            QStringLiteral("--xwayland-fd"), QStringLiteral("10"),
+            QStringLiteral("--xwayland-fd"), QStringLiteral("11"),
+            QStringLiteral("--wayland-fd"), QStringLiteral("9"),
+            QStringLiteral("--socket"), QStringLiteral("wayland-0"),
+        }));
+    }
+
+    void xwaylandWithoutXauthority()
+    {
+        const QStringList arguments = ProcessManager::windowManagerArguments(
+                    QString(), -1, QStringLiteral(":2"), QList<int>({ 12 }), QString());
+
+        QCOMPARE(arguments, QStringList({
+            QStringLiteral("--xwayland"),
+            QStringLiteral("--xwayland-display"), QStringLiteral(":2"),
+            QStringLiteral("--xwayland-fd"), QStringLiteral("12"),
+        }));
+    }
+
+    void nothingHandedOver()
+    {
+        QVERIFY(ProcessManager::windowManagerArguments(QString(), -1, QString(), QList<int>(), QString()).isEmpty());
+    }
+};
+
+QTEST_GUILESS_MAIN(WindowManagerArgumentsTest)
+#include "tst_windowmanagerarguments.moc"
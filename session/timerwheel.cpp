@@ -0,0 +1,71 @@
+#include "timerwheel.h"
+
+#include <QTimer>
+
+TimerWheel::TimerWheel(int tickMsecs, int slotCount, QObject *parent)
+    : QObject(parent)
+    , m_tick(tickMsecs)
+    , m_current(0)
+    , m_nextId(1)
+    , m_slots(slotCount)
+    , m_timer(new QTimer(this))
+{
+    m_timer->setInterval(m_tick);
+    m_timer->setTimerType(Qt::CoarseTimer);
+    connect(m_timer, &QTimer::timeout, this, &TimerWheel::advance);
+}
+
+quint64 TimerWheel::schedule(int msecs, const std::function<void()> &callback)
+{
+    const int ticks = qMax(1, (msecs + m_tick - 1) / m_tick);
+    const int slot = (m_current + ticks) % m_slots.size();
+    const quint64 id = m_nextId++;
+
+    m_slots[slot].append(Entry { id, (ticks - 1) / m_slots.size(), callback });
+    m_slotOf.insert(id, slot);
+
+    if (!m_timer->isActive())
+        m_timer->start();
+
+    return id;
+}
+
+void TimerWheel::cancel(quint64 id)
+{
+    const auto it = m_slotOf.find(id);
+    if (it == m_slotOf.end())
+        return;
+
+    QList<Entry> &entries = m_slots[it.value()];
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries.at(i).id == id) {
+            entries.removeAt(i);
+            break;
+        }
+    }
+    m_slotOf.erase(it);
+}
+
+void TimerWheel::advance()
+{
+    m_current = (m_current + 1) % m_slots.size();
+
+    // Callbacks may schedule and cancel, collect the due ones first.
+    QList<Entry> due;
+    QList<Entry> &entries = m_slots[m_current];
+    for (int i = 0; i < entries.size();) {
+        if (entries.at(i).rounds > 0) {
+            --entries[i].rounds;
+            ++i;
+            continue;
+        }
+        m_slotOf.remove(entries.at(i).id);
+        due.append(entries.takeAt(i));
+    }
+
+    for (const Entry &entry : qAsConst(due))
+        entry.callback();
+
+    if (m_slotOf.isEmpty())
+        m_timer->stop();
+}
@@ -0,0 +1,46 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+
+#include <functional>
+
+class QTimer;
+
+/*! Hashed timer wheel: a single coarse QTimer drives any number of one-shot callbacks.
+    Scheduling and cancelling are O(1), callbacks fire up to one tick late.
+*/
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TimerWheel(int tickMsecs = 250, int slotCount = 256, QObject *parent = nullptr);
+
+    /// Runs callback once after msecs, returns an id for cancel().
+    quint64 schedule(int msecs, const std::function<void()> &callback);
+    void cancel(quint64 id);
+
+    int size() const { return m_slotOf.size(); }
+
+private slots:
+    void advance();
+
+private:
+    struct Entry {
+        quint64 id;
+        int rounds;
+        std::function<void()> callback;
+    };
+
+    int m_tick;
+    int m_current;
+    quint64 m_nextId;
+    QVector<QList<Entry>> m_slots;
+    QHash<quint64, int> m_slotOf;
+    QTimer *m_timer;
+};
+
+#endif // TIMERWHEEL_H
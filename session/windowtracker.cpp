@@ -0,0 +1,201 @@
+#include "windowtracker.h"
+#include "sessionmetrics.h"
+
+#include <QDBusPendingCallWatcher>
+#include <QDBusServiceWatcher>
+#include <QDBusConnectionInterface>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusReply>
+#include <QStandardPaths>
+#include <QDebug>
+#include <QFile>
+
+#include <unistd.h>
+
+static const QString kwinService = QStringLiteral("org.kde.KWin");
+static const QString scriptName = QStringLiteral("prts-windowtracker");
+// Launches without a window by then are not waited for any longer.
+static const qint64 pendingTimeout = 2 * 60 * 1000;
+// Launchers rarely nest deeper than a shell script starting a wrapper starting the app.
+static const int maxAncestors = 8;
+
+static QString launchToken(qint64 pid)
+{
+    // The environment the process was executed with, later setenv() calls do not show up here.
+    QFile file(QStringLiteral("/proc/%1/environ").arg(pid));
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    const QByteArray prefix = WindowTracker::launchTokenVariable().toLatin1() + '=';
+    for (const QByteArray &variable : file.readAll().split('\0')) {
+        if (variable.startsWith(prefix))
+            return QString::fromLatin1(variable.mid(prefix.size()));
+    }
+    return QString();
+}
+
+static qint64 parentPid(qint64 pid)
+{
+    QFile file(QStringLiteral("/proc/%1/stat").arg(pid));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+
+    const QByteArray stat = file.readAll();
+    const QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    return fields.size() > 1 ? fields.at(1).toLongLong() : 0;
+}
+
+WindowTracker::WindowTracker(QObject *parent)
+    : QObject(parent)
+    , m_kwinWatcher(new QDBusServiceWatcher(kwinService, QDBusConnection::sessionBus(),
+                                            QDBusServiceWatcher::WatchForOwnerChange, this))
+{
+    connect(m_kwinWatcher, &QDBusServiceWatcher::serviceOwnerChanged, this, &WindowTracker::kwinOwnerChanged);
+
+    // kwin may already run, after a re-exec of the session.
+    const QDBusReply<QString> owner = QDBusConnection::sessionBus().interface()->serviceOwner(kwinService);
+    if (owner.isValid() && !owner.value().isEmpty()) {
+        m_kwinOwner = owner.value();
+        loadScript();
+    }
+}
+
+void WindowTracker::kwinOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner)
+{
+    Q_UNUSED(service)
+    Q_UNUSED(oldOwner)
+
+    m_kwinOwner = newOwner;
+    if (!newOwner.isEmpty())
+        loadScript();
+}
+
+void WindowTracker::loadScript()
+{
+    const QString path = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
+                                                QStringLiteral("prts-session/kwin/windowtracker.js"));
+    if (path.isEmpty()) {
+        qWarning() << "KWin window tracker script not installed, time to first window is not measured";
+        return;
+    }
+
+    QDBusConnection bus = QDBusConnection::sessionBus();
+
+    QDBusMessage unload = QDBusMessage::createMethodCall(kwinService, QStringLiteral("/Scripting"),
+                                                         QStringLiteral("org.kde.kwin.Scripting"),
+                                                         QStringLiteral("unloadScript"));
+    unload << scriptName;
+    bus.asyncCall(unload);
+
+    QDBusMessage load = QDBusMessage::createMethodCall(kwinService, QStringLiteral("/Scripting"),
+                                                       QStringLiteral("org.kde.kwin.Scripting"),
+                                                       QStringLiteral("loadScript"));
+    load << path << scriptName;
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(bus.asyncCall(load), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [watcher] {
+        const QDBusReply<int> reply = *watcher;
+        watcher->deleteLater();
+
+        if (!reply.isValid() || reply.value() < 0) {
+            qWarning() << "Could not load KWin window tracker script:" << reply.error().message();
+            return;
+        }
+
+        QDBusMessage run = QDBusMessage::createMethodCall(kwinService,
+                                                          QStringLiteral("/Scripting/Script%1").arg(reply.value()),
+                                                          QStringLiteral("org.kde.kwin.Script"),
+                                                          QStringLiteral("run"));
+        QDBusConnection::sessionBus().asyncCall(run);
+    });
+}
+
+QString WindowTracker::newLaunchToken()
+{
+    static quint64 next = 0;
+    return QStringLiteral("%1-%2").arg(::getpid()).arg(++next);
+}
+
+void WindowTracker::track(qint64 pid, const QString &kind, const QString &name, const QString &desktopId,
+                          const QString &token, const QElapsedTimer &spawn)
+{
+    if (pid <= 0)
+        return;
+
+    expire();
+    m_pending.insert(pid, Pending { kind, name, desktopId, token, spawn });
+}
+
+void WindowTracker::expire()
+{
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (it->spawn.elapsed() > pendingTimeout)
+            it = m_pending.erase(it);
+        else
+            ++it;
+    }
+}
+
+qint64 WindowTracker::findLaunch(qint64 pid, const QString &desktopFileName) const
+{
+    const qint64 self = ::getpid();
+    for (qint64 ancestor = pid, depth = 0; ancestor > 1 && ancestor != self && depth < maxAncestors; ++depth) {
+        if (m_pending.contains(ancestor))
+            return ancestor;
+        ancestor = parentPid(ancestor);
+    }
+
+    // Daemonized launchers are reparented away from us but keep the environment.
+    const QString token = launchToken(pid);
+    if (!token.isEmpty()) {
+        for (auto it = m_pending.constBegin(); it != m_pending.constEnd(); ++it) {
+            if (it->token == token)
+                return it.key();
+        }
+    }
+
+    // D-Bus activated or single-instance apps map their window from another process.
+    // With several launches of the same app pending, the oldest one gets the first window.
+    if (desktopFileName.isEmpty())
+        return 0;
+    qint64 oldest = 0;
+    qint64 oldestAge = -1;
+    for (auto it = m_pending.constBegin(); it != m_pending.constEnd(); ++it) {
+        if (it->desktopId != desktopFileName && it->desktopId != desktopFileName + QStringLiteral(".desktop"))
+            continue;
+        const qint64 age = it->spawn.elapsed();
+        if (age > oldestAge) {
+            oldest = it.key();
+            oldestAge = age;
+        }
+    }
+    return oldest;
+}
+
+void WindowTracker::windowShown(const QString &sender, qint64 pid, const QString &desktopFileName)
+{
+    if (m_kwinOwner.isEmpty() || sender != m_kwinOwner) {
+        qWarning() << "Ignoring window report from" << sender << ", it is not KWin";
+        return;
+    }
+
+    expire();
+
+    const qint64 launch = findLaunch(pid, desktopFileName);
+    if (!launch)
+        return;
+
+    const Pending pending = m_pending.take(launch);
+    const qint64 nsecs = pending.spawn.nsecsElapsed();
+
+    SessionMetrics *metrics = SessionMetrics::self();
+    metrics->histogram("prts_session_time_to_first_window_seconds",
+                       "Time from spawning a process until its first toplevel window was mapped.",
+                       SessionMetrics::label("kind", pending.kind))->observe(nsecs);
+    metrics->gauge("prts_session_first_window_seconds",
+                   "Time until the first window of each component in this session.",
+                   SessionMetrics::label("component", pending.name))->set(nsecs / 1e9);
+
+    qDebug() << "First window of" << pending.name << "after" << nsecs / 1000000 << "ms";
+}
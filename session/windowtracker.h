@@ -0,0 +1,54 @@
+#ifndef WINDOWTRACKER_H
+#define WINDOWTRACKER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+
+class QDBusServiceWatcher;
+
+/*! Measures the time from spawning a component until its first toplevel window is mapped.
+    Wayland gives the session no view of other clients' windows, a KWin script reports
+    them through WindowShown(). Windows are matched to launches by PID, walking up the
+    parent chain for launchers that fork, then by the launch token every process started
+    by the session inherits, then by desktop file name.
+*/
+class WindowTracker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WindowTracker(QObject *parent = nullptr);
+
+    /// Environment variable holding the launch token, see newLaunchToken().
+    static QString launchTokenVariable() { return QStringLiteral("PRTS_LAUNCH_TOKEN"); }
+    /// Returns a token unique to this session, to be put into the environment of a launch.
+    static QString newLaunchToken();
+
+    /// Waits for the first window of a process spawned when spawn was started.
+    void track(qint64 pid, const QString &kind, const QString &name, const QString &desktopId,
+               const QString &token, const QElapsedTimer &spawn);
+    /// Called for WindowShown() from the bus, reports from anyone but KWin are ignored.
+    void windowShown(const QString &sender, qint64 pid, const QString &desktopFileName);
+
+private:
+    struct Pending {
+        QString kind;
+        QString name;
+        QString desktopId;
+        QString token;
+        QElapsedTimer spawn;
+    };
+
+    void kwinOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner);
+    void loadScript();
+    void expire();
+    qint64 findLaunch(qint64 pid, const QString &desktopFileName) const;
+
+    QHash<qint64, Pending> m_pending;
+    QDBusServiceWatcher *m_kwinWatcher;
+    /// Unique bus name of the KWin that runs the script.
+    QString m_kwinOwner;
+};
+
+#endif // WINDOWTRACKER_H
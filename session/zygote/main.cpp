@@ -0,0 +1,211 @@
+#include "zygoteprotocol.h"
+#include "prts-zygote.h"
+
+#include <QLibraryInfo>
+#include <QDataStream>
+#include <QStringList>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+
+#include <set>
+#include <vector>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// prts-zygote never creates a QCoreApplication: it must stay single threaded to fork safely.
+
+static std::set<pid_t> s_children;
+static int s_signalFd = -1;
+
+static void sendMessage(const QByteArray &message)
+{
+    ::send(ZygoteSocketFd, message.constData(), size_t(message.size()), MSG_NOSIGNAL);
+}
+
+static void sendError(quint32 id, const QString &error)
+{
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out << quint8(ZygoteError) << id << error;
+    sendMessage(message);
+}
+
+static void preload()
+{
+    // Qt Core, Gui and Quick are linked with -z now and --no-as-needed,
+    // so they are already mapped and relocated when main() runs.
+
+    // The Wayland platform plugin is what every component loads first.
+    const QString platforms = QLibraryInfo::path(QLibraryInfo::PluginsPath) + QStringLiteral("/platforms");
+    const QStringList plugins = QDir(platforms).entryList({ QStringLiteral("libqwayland*.so") }, QDir::Files);
+    for (const QString &plugin : plugins)
+        dlopen(QFile::encodeName(platforms + QLatin1Char('/') + plugin).constData(), RTLD_NOW);
+}
+
+[[noreturn]] static void runChild(quint32 id, const QString &module, const QStringList &args,
+                                  const QStringList &env, const QString &cwd)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, nullptr);
+    ::close(s_signalFd);
+
+    // Components go down with the zygote, as they would with the session.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    if (!cwd.isEmpty() && ::chdir(QFile::encodeName(cwd).constData()) != 0) {
+        sendError(id, QStringLiteral("Cannot change directory to %1").arg(cwd));
+        _exit(127);
+    }
+
+    clearenv();
+    for (const QString &variable : env)
+        putenv(strdup(variable.toLocal8Bit().constData()));
+
+    void *handle = dlopen(QFile::encodeName(module).constData(), RTLD_NOW);
+    PrtsZygoteMain entry = handle ? reinterpret_cast<PrtsZygoteMain>(dlsym(handle, PRTS_ZYGOTE_ENTRY)) : nullptr;
+    if (!entry) {
+        sendError(id, QString::fromLocal8Bit(dlerror()));
+        _exit(127);
+    }
+
+    ::close(ZygoteSocketFd);
+
+    if (!args.isEmpty())
+        prctl(PR_SET_NAME, QFile::encodeName(QFileInfo(args.constFirst()).fileName()).left(15).constData());
+
+    std::vector<QByteArray> storage;
+    std::vector<char *> argv;
+    for (const QString &arg : args)
+        storage.push_back(arg.toLocal8Bit());
+    for (QByteArray &arg : storage)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    exit(entry(int(storage.size()), argv.data()));
+}
+
+static void spawn(QDataStream &in)
+{
+    quint32 id;
+    QString module;
+    QStringList args;
+    QStringList env;
+    QString cwd;
+    in >> id >> module >> args >> env >> cwd;
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        sendError(id, QString::fromLocal8Bit(strerror(errno)));
+        return;
+    }
+
+    if (pid == 0)
+        runChild(id, module, args, env, cwd);
+
+    s_children.insert(pid);
+
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out << quint8(ZygoteSpawned) << id << qint64(pid);
+    sendMessage(message);
+}
+
+static void reapChildren()
+{
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        s_children.erase(pid);
+
+        QByteArray message;
+        QDataStream out(&message, QIODevice::WriteOnly);
+        out << quint8(ZygoteExited) << qint64(pid)
+            << qint32(WIFEXITED(status) ? WEXITSTATUS(status) : -1)
+            << bool(WIFSIGNALED(status));
+        sendMessage(message);
+    }
+}
+
+static void shutdownChildren()
+{
+    for (pid_t pid : s_children)
+        kill(pid, SIGTERM);
+
+    // Give children two seconds to exit, like ProcessManager::shutdown() does for its own.
+    for (int i = 0; i < 20 && !s_children.empty(); ++i) {
+        usleep(100 * 1000);
+        reapChildren();
+    }
+
+    for (pid_t pid : s_children)
+        kill(pid, SIGKILL);
+    reapChildren();
+}
+
+int main(int argc, char *argv[])
+{
+    Q_UNUSED(argc)
+    Q_UNUSED(argv)
+
+    preload();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    s_signalFd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    QByteArray buffer(ZygoteMaxMessage, Qt::Uninitialized);
+    pollfd fds[2] = {
+        { ZygoteSocketFd, POLLIN, 0 },
+        { s_signalFd, POLLIN, 0 }
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            signalfd_siginfo info;
+            while (read(s_signalFd, &info, sizeof(info)) < 0 && errno == EINTR) { }
+            reapChildren();
+        }
+
+        if (fds[0].revents & POLLIN) {
+            const ssize_t size = recv(ZygoteSocketFd, buffer.data(), size_t(buffer.size()), 0);
+            if (size <= 0)
+                break;
+
+            QDataStream in(QByteArray::fromRawData(buffer.constData(), int(size)));
+            quint8 operation;
+            in >> operation;
+
+            if (operation == ZygoteSpawn)
+                spawn(in);
+            else if (operation == ZygoteShutdown)
+                break;
+        } else if (fds[0].revents & (POLLHUP | POLLERR)) {
+            break;
+        }
+    }
+
+    // The session asked us to stop, or went away.
+    shutdownChildren();
+    return 0;
+}
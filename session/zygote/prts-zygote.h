@@ -0,0 +1,25 @@
+#ifndef PRTS_ZYGOTE_H
+#define PRTS_ZYGOTE_H
+
+/*
+ * Entry point for shell components started from prts-zygote.
+ *
+ * A component opts in by building a shared library that exports
+ * PRTS_ZYGOTE_MAIN and setting ZygoteModule= to its path in the session
+ * manifest. The function is called in a freshly forked child of the zygote,
+ * with Qt already mapped and relocated, and should behave like main():
+ *
+ *     PRTS_ZYGOTE_MAIN(argc, argv)
+ *     {
+ *         QGuiApplication app(argc, argv);
+ *         ...
+ *         return app.exec();
+ *     }
+ */
+#define PRTS_ZYGOTE_ENTRY "prts_zygote_main"
+#define PRTS_ZYGOTE_MAIN(argc, argv) \
+    extern "C" __attribute__((visibility("default"))) int prts_zygote_main(int argc, char **argv)
+
+typedef int (*PrtsZygoteMain)(int argc, char **argv);
+
+#endif // PRTS_ZYGOTE_H
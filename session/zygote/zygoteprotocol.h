@@ -0,0 +1,28 @@
+#ifndef ZYGOTEPROTOCOL_H
+#define ZYGOTEPROTOCOL_H
+
+#include <QtGlobal>
+
+/*
+ * prts-session talks to prts-zygote over a SOCK_SEQPACKET socket inherited as
+ * ZygoteSocketFd. Every packet is one message serialized with QDataStream,
+ * starting with a quint8 operation:
+ *
+ *   ZygoteSpawn    quint32 id, QString module, QStringList args, QStringList env, QString cwd
+ *   ZygoteShutdown (no payload) terminate all children, then exit
+ *   ZygoteSpawned  quint32 id, qint64 pid
+ *   ZygoteError    quint32 id, QString message
+ *   ZygoteExited   qint64 pid, qint32 exitCode, bool crashed
+ */
+enum ZygoteOperation : quint8 {
+    ZygoteSpawn = 'S',
+    ZygoteShutdown = 'Q',
+    ZygoteSpawned = 'P',
+    ZygoteError = 'E',
+    ZygoteExited = 'X'
+};
+
+static const int ZygoteSocketFd = 3;
+static const int ZygoteMaxMessage = 64 * 1024;
+
+#endif // ZYGOTEPROTOCOL_H
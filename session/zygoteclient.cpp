@@ -0,0 +1,219 @@
+#include "zygoteclient.h"
+#include "zygote/zygoteprotocol.h"
+#include "process.h"
+
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QDataStream>
+#include <QProcess>
+#include <QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const QString zygoteProgram = QStringLiteral("prts-zygote");
+
+ZygoteClient::ZygoteClient(QObject *parent)
+    : QObject(parent)
+    , m_process(nullptr)
+    , m_adopted(nullptr)
+    , m_notifier(nullptr)
+    , m_socket(-1)
+    , m_nextId(1)
+{
+}
+
+ZygoteClient::~ZygoteClient()
+{
+    if (m_socket >= 0)
+        ::close(m_socket);
+}
+
+bool ZygoteClient::isAvailable()
+{
+    return !QStandardPaths::findExecutable(zygoteProgram).isEmpty();
+}
+
+bool ZygoteClient::start(const QProcessEnvironment &environment)
+{
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+        qWarning() << "Could not create zygote socket:" << strerror(errno);
+        return false;
+    }
+
+    const int remote = fds[1];
+    m_socket = fds[0];
+
+    m_process = new QProcess(this);
+    m_process->setProcessChannelMode(QProcess::ForwardedChannels);
+    m_process->setProcessEnvironment(environment);
+    m_process->setChildProcessModifier([remote] {
+        if (remote == ZygoteSocketFd)
+            ::fcntl(remote, F_SETFD, 0);
+        else
+            ::dup2(remote, ZygoteSocketFd);
+    });
+    m_process->start(QStandardPaths::findExecutable(zygoteProgram), QStringList());
+    ::close(remote);
+
+    if (!m_process->waitForStarted()) {
+        qWarning() << "Could not start zygote:" << m_process->errorString();
+        ::close(m_socket);
+        m_socket = -1;
+        return false;
+    }
+
+    watchSocket();
+
+    qDebug() << "Zygote started, pid" << m_process->processId();
+    return true;
+}
+
+bool ZygoteClient::adopt(qint64 pid, int socket)
+{
+    if (pid <= 0 || socket < 0)
+        return false;
+
+    m_socket = socket;
+    ::fcntl(m_socket, F_SETFD, FD_CLOEXEC);
+    m_adopted = new AdoptedProcess(pid, QStringLiteral("zygote"), zygoteProgram, this);
+    watchSocket();
+
+    qDebug() << "Zygote adopted, pid" << pid;
+    return true;
+}
+
+void ZygoteClient::watchSocket()
+{
+    m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &ZygoteClient::readMessages);
+}
+
+bool ZygoteClient::isRunning() const
+{
+    if (m_socket < 0)
+        return false;
+    if (m_adopted)
+        return m_adopted->isRunning();
+    return m_process && m_process->state() == QProcess::Running;
+}
+
+qint64 ZygoteClient::processId() const
+{
+    if (m_adopted)
+        return m_adopted->processId();
+    return m_process ? m_process->processId() : 0;
+}
+
+void ZygoteClient::prepareForReexec()
+{
+    if (m_socket >= 0)
+        ::fcntl(m_socket, F_SETFD, 0);
+}
+
+quint32 ZygoteClient::spawn(const QString &module, const QStringList &arguments,
+                            const QProcessEnvironment &environment, const QString &workingDirectory)
+{
+    const quint32 id = m_nextId++;
+    m_pending.insert(id);
+
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out << quint8(ZygoteSpawn) << id << module << arguments << environment.toStringList() << workingDirectory;
+
+    if (message.size() > ZygoteMaxMessage
+            || ::send(m_socket, message.constData(), size_t(message.size()), MSG_NOSIGNAL) < 0) {
+        const QString error = QStringLiteral("Could not send spawn request to zygote");
+        m_pending.remove(id);
+        QMetaObject::invokeMethod(this, [this, id, error] { emit failed(id, error); }, Qt::QueuedConnection);
+    }
+
+    return id;
+}
+
+void ZygoteClient::shutdown(int timeout)
+{
+    if (!isRunning())
+        return;
+
+    const char message = char(ZygoteShutdown);
+    ::send(m_socket, &message, 1, MSG_NOSIGNAL);
+
+    if (m_adopted) {
+        if (!m_adopted->waitForFinished(timeout + 1000))
+            m_adopted->kill();
+    } else if (!m_process->waitForFinished(timeout + 1000)) {
+        m_process->kill();
+    }
+}
+
+void ZygoteClient::readMessages()
+{
+    QByteArray buffer(ZygoteMaxMessage, Qt::Uninitialized);
+
+    for (;;) {
+        const ssize_t size = ::recv(m_socket, buffer.data(), size_t(buffer.size()), MSG_DONTWAIT);
+        if (size == 0) {
+            disconnected();
+            return;
+        }
+        if (size < 0)
+            return;
+
+        QDataStream in(QByteArray::fromRawData(buffer.constData(), int(size)));
+        quint8 operation;
+        in >> operation;
+
+        switch (operation) {
+        case ZygoteSpawned: {
+            quint32 id;
+            qint64 pid;
+            in >> id >> pid;
+            m_pending.remove(id);
+            emit spawned(id, pid);
+            break;
+        }
+        case ZygoteError: {
+            quint32 id;
+            QString error;
+            in >> id >> error;
+            m_pending.remove(id);
+            emit failed(id, error);
+            break;
+        }
+        case ZygoteExited: {
+            qint64 pid;
+            qint32 exitCode;
+            bool crashed;
+            in >> pid >> exitCode >> crashed;
+            emit finished(pid, exitCode, crashed);
+            break;
+        }
+        default:
+            qWarning() << "Unknown zygote message" << operation;
+            break;
+        }
+    }
+}
+
+void ZygoteClient::disconnected()
+{
+    // The zygote went away, its children were terminated with it.
+    qWarning() << "Zygote exited, pid" << processId();
+    m_notifier->setEnabled(false);
+    m_notifier->deleteLater();
+    m_notifier = nullptr;
+    ::close(m_socket);
+    m_socket = -1;
+
+    const QSet<quint32> pending = m_pending;
+    m_pending.clear();
+    for (quint32 id : pending)
+        emit failed(id, QStringLiteral("Zygote exited"));
+
+    emit lost();
+}
@@ -0,0 +1,66 @@
+#ifndef ZYGOTECLIENT_H
+#define ZYGOTECLIENT_H
+
+#include <QObject>
+#include <QProcessEnvironment>
+#include <QSet>
+
+class QProcess;
+class QSocketNotifier;
+class AdoptedProcess;
+
+/*! Starts prts-zygote and asks it to fork preloaded shell components.
+    Children of the zygote are not children of the session, their exits are reported by finished().
+    If the zygote itself goes away its children die with it, lost() is emitted instead.
+*/
+class ZygoteClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ZygoteClient(QObject *parent = nullptr);
+    ~ZygoteClient() override;
+
+    static bool isAvailable();
+
+    bool start(const QProcessEnvironment &environment);
+    bool isRunning() const;
+
+    qint64 processId() const;
+    int socket() const { return m_socket; }
+
+    /// Keeps the zygote socket open across exec(), so a re-executed session can adopt() it.
+    void prepareForReexec();
+    /// Takes over a zygote started by a previous instance of the session.
+    bool adopt(qint64 pid, int socket);
+
+    /// Requests a new component, returns the request id used by spawned() and failed().
+    quint32 spawn(const QString &module, const QStringList &arguments,
+                  const QProcessEnvironment &environment, const QString &workingDirectory = QString());
+
+    /// Terminates all zygote children and the zygote itself, waiting at most timeout ms.
+    void shutdown(int timeout);
+
+signals:
+    void spawned(quint32 id, qint64 pid);
+    void failed(quint32 id, const QString &error);
+    void finished(qint64 pid, int exitCode, bool crashed);
+    /// The zygote exited, every child it forked is gone and pending requests failed.
+    void lost();
+
+private slots:
+    void readMessages();
+
+private:
+    void watchSocket();
+    void disconnected();
+
+    QProcess *m_process;
+    AdoptedProcess *m_adopted;
+    QSocketNotifier *m_notifier;
+    int m_socket;
+    quint32 m_nextId;
+    QSet<quint32> m_pending;
+};
+
+#endif // ZYGOTECLIENT_H